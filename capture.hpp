@@ -0,0 +1,466 @@
+#pragma once
+#include "helpers.hpp"
+#include <boost/pfr/core.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+// Recording of command streams, to replay them offline (see gpp_replay.cpp).
+//
+// A capture is a header followed by one record per command:
+//
+//   "GPPC" | u32 version
+//   record: u32 node | u8 stream | u8 0 | u16 command | u32 result | u32 size | body
+//
+// "command" is the index of the command in the action variant of "stream",
+// "result" the id given to the handle returned by the command, if any, and
+// the body holds the command's fields, in declaration order:
+// - handles are written as the u32 id they were given when first returned,
+// - "void* data" fields as "size" bytes of payload, aligned on 16 bytes in
+//   the file so that a memory-mapped capture can be used in place,
+// - anything else as its raw bytes.
+namespace gpu
+{
+enum class capture_stream : std::uint8_t
+{
+  update,
+  dispatch,
+  release
+};
+
+namespace capture_format
+{
+inline constexpr char magic[4] = {'G', 'P', 'P', 'C'};
+inline constexpr std::uint32_t version = 8;
+inline constexpr std::size_t payload_alignment = 16;
+
+// Commands not issued by a node, e.g. by the host's frame_context
+inline constexpr std::uint32_t host_node = 0xFFFFFFFF;
+
+struct record_header
+{
+  std::uint32_t node;
+  std::uint8_t stream;
+  std::uint8_t reserved;
+  std::uint16_t command;
+  std::uint32_t result;
+  std::uint32_t size;
+};
+static_assert(sizeof(record_header) == 16);
+
+template <typename T, typename Variant>
+struct variant_index;
+
+template <typename T, typename... Ts>
+struct variant_index<T, std::variant<Ts...>>
+{
+  static constexpr int value = []
+  {
+    constexpr bool same[] = {std::is_same_v<T, Ts>...};
+    for (int i = 0; i < int(sizeof...(Ts)); i++)
+      if (same[i])
+        return i;
+    return -1;
+  }();
+};
+
+template <capture_stream S>
+using action_of = std::conditional_t<
+    S == capture_stream::update, update_action,
+    std::conditional_t<S == capture_stream::dispatch, dispatch_action, release_action>>;
+
+// Handles are pointers to incomplete types
+template <typename F>
+constexpr bool is_handle = std::is_pointer_v<F> && !std::is_void_v<std::remove_pointer_t<F>>;
+
+template <typename>
+constexpr bool is_optional = false;
+template <typename T>
+constexpr bool is_optional<std::optional<T>> = true;
+
+// The handle in a command's result, if any
+template <typename R>
+const void* result_handle(const R& result) noexcept
+{
+  if constexpr (is_handle<R>)
+    return result;
+  else if constexpr (requires { requires is_handle<decltype(result.handle)>; })
+    return result.handle;
+  else
+    return nullptr;
+}
+}
+
+// Wraps a backend: forwards every command to it and records it.
+// The host tells which node is running with begin().
+template <typename Backend>
+class capture_writer
+{
+public:
+  capture_writer(Backend& backend, const std::string& path)
+      : m_backend{backend}
+      , m_file{path, std::ios::binary}
+  {
+    write(capture_format::magic, sizeof(capture_format::magic));
+    write_value(capture_format::version);
+  }
+
+  capture_writer(const capture_writer&) = delete;
+  capture_writer& operator=(const capture_writer&) = delete;
+
+  explicit operator bool() const noexcept { return bool(m_file); }
+
+  void begin(std::uint32_t node, capture_stream stream) noexcept
+  {
+    m_node = node;
+    m_stream = stream;
+  }
+
+  void end() noexcept { m_node = capture_format::host_node; }
+
+  template <typename C>
+  typename C::return_type operator()(const C& command)
+  {
+    if constexpr (std::is_void_v<typename C::return_type>)
+    {
+      m_backend(command);
+      record(command, 0);
+    }
+    else
+    {
+      auto result = m_backend(command);
+      record(command, result_id<C>(capture_format::result_handle(result)));
+      return result;
+    }
+  }
+
+  // Forwarded so that the capture can sit in front of any other layer
+  void end_frame()
+  {
+    if constexpr (requires { m_backend.end_frame(); })
+      m_backend.end_frame();
+    m_file.flush();
+  }
+
+  bool owns_staging(const void* ptr) const
+  {
+    if constexpr (requires { m_backend.owns_staging(ptr); })
+      return m_backend.owns_staging(ptr);
+    else
+      return false;
+  }
+
+private:
+  template <typename C>
+  std::uint32_t result_id(const void* handle)
+  {
+    if (!handle)
+      return 0;
+
+    // Getters hand out the same resource again ; anything else is new,
+    // even if the backend reuses the address of a released resource.
+    if constexpr (requires { C::getter; })
+    {
+      if (auto it = m_ids.find(handle); it != m_ids.end())
+        return it->second;
+    }
+    return m_ids[handle] = m_next_id++;
+  }
+
+  std::uint32_t handle_id(const void* handle) const
+  {
+    if (!handle)
+      return 0;
+    auto it = m_ids.find(handle);
+    return it != m_ids.end() ? it->second : 0;
+  }
+
+  template <typename C>
+  void record(const C& command, std::uint32_t result)
+  {
+    capture_stream stream = m_stream;
+    int index = command_index<C>(stream);
+    for (auto s : {capture_stream::update, capture_stream::dispatch, capture_stream::release})
+    {
+      if (index >= 0)
+        break;
+      stream = s;
+      index = command_index<C>(stream);
+    }
+    static_assert(
+        capture_format::variant_index<C, update_action>::value >= 0
+            || capture_format::variant_index<C, dispatch_action>::value >= 0
+            || capture_format::variant_index<C, release_action>::value >= 0,
+        "command is not part of any action");
+
+    // The body goes in a scratch buffer first, to know its size.
+    // Payload alignment is relative to the file, which follows the header.
+    m_body.clear();
+    const std::size_t body_offset = m_offset + sizeof(capture_format::record_header);
+    boost::pfr::for_each_field(
+        command,
+        [&]<typename F>(const F& field)
+        {
+          if constexpr (capture_format::is_handle<F>)
+          {
+            append_value(handle_id(field));
+          }
+          else if constexpr (std::is_same_v<F, void*>)
+          {
+            const std::uint32_t size = field ? command.size : 0;
+            append_value(size);
+            while ((body_offset + m_body.size()) % capture_format::payload_alignment != 0)
+              m_body.push_back(0);
+            append(field, size);
+          }
+          else if constexpr (capture_format::is_optional<F>)
+          {
+            append_value(std::uint8_t(field.has_value()));
+            append_value(field.value_or(typename F::value_type{}));
+          }
+          else
+          {
+            static_assert(std::is_trivially_copyable_v<F> && !std::is_pointer_v<F>);
+            append_value(field);
+          }
+        });
+
+    const capture_format::record_header header{
+        .node = m_node,
+        .stream = std::uint8_t(stream),
+        .reserved = 0,
+        .command = std::uint16_t(index),
+        .result = result,
+        .size = std::uint32_t(m_body.size())};
+    write_value(header);
+    write(m_body.data(), m_body.size());
+  }
+
+  template <typename C>
+  static int command_index(capture_stream stream) noexcept
+  {
+    switch (stream)
+    {
+      case capture_stream::update:
+        return capture_format::variant_index<C, update_action>::value;
+      case capture_stream::dispatch:
+        return capture_format::variant_index<C, dispatch_action>::value;
+      case capture_stream::release:
+        return capture_format::variant_index<C, release_action>::value;
+    }
+    return -1;
+  }
+
+  void append(const void* data, std::size_t size)
+  {
+    auto bytes = static_cast<const char*>(data);
+    m_body.insert(m_body.end(), bytes, bytes + size);
+  }
+
+  template <typename T>
+  void append_value(const T& value)
+  {
+    append(&value, sizeof(value));
+  }
+
+  void write(const void* data, std::size_t size)
+  {
+    m_file.write(static_cast<const char*>(data), size);
+    m_offset += size;
+  }
+
+  template <typename T>
+  void write_value(const T& value)
+  {
+    write(&value, sizeof(value));
+  }
+
+  Backend& m_backend;
+  std::ofstream m_file;
+  std::size_t m_offset{};
+  std::vector<char> m_body;
+
+  std::unordered_map<const void*, std::uint32_t> m_ids;
+  std::uint32_t m_next_id{1};
+
+  std::uint32_t m_node{capture_format::host_node};
+  capture_stream m_stream{capture_stream::update};
+};
+
+// Replays a capture from memory, e.g. a mapped file.
+// Payloads are passed to the backend in place, without any copy: the memory
+// must stay valid, and writable, while replaying.
+class capture_reader
+{
+public:
+  capture_reader(char* data, std::size_t size) noexcept
+      : m_data{data}
+      , m_size{size}
+  {
+  }
+
+  bool valid() const noexcept
+  {
+    std::uint32_t version{};
+    if (m_size < sizeof(capture_format::magic) + sizeof(version))
+      return false;
+    std::memcpy(&version, m_data + sizeof(capture_format::magic), sizeof(version));
+    return std::memcmp(m_data, capture_format::magic, sizeof(capture_format::magic)) == 0
+           && version == capture_format::version;
+  }
+
+  // Runs every command of the capture on the backend.
+  // Returns the number of commands replayed, or -1 if the capture is corrupt.
+  template <typename Backend>
+  long replay(Backend& backend)
+  {
+    std::vector<void*> handles{nullptr};
+    long count = 0;
+    std::size_t offset = sizeof(capture_format::magic) + sizeof(std::uint32_t);
+    while (offset + sizeof(capture_format::record_header) <= m_size)
+    {
+      capture_format::record_header header;
+      std::memcpy(&header, m_data + offset, sizeof(header));
+      offset += sizeof(header);
+      if (offset + header.size > m_size)
+        return -1;
+
+      bool ok = false;
+      switch (capture_stream(header.stream))
+      {
+        case capture_stream::update:
+          ok = run<update_action>(backend, header, offset, handles);
+          break;
+        case capture_stream::dispatch:
+          ok = run<dispatch_action>(backend, header, offset, handles);
+          break;
+        case capture_stream::release:
+          ok = run<release_action>(backend, header, offset, handles);
+          break;
+      }
+      if (!ok)
+        return -1;
+
+      offset += header.size;
+      count++;
+    }
+    return count;
+  }
+
+private:
+  template <typename Action, typename Backend>
+  bool run(
+      Backend& backend, const capture_format::record_header& header, std::size_t offset,
+      std::vector<void*>& handles)
+  {
+    using replay_function = bool (*)(
+        capture_reader&, Backend&, const capture_format::record_header&, std::size_t,
+        std::vector<void*>&);
+
+    static constexpr auto table = []<std::size_t... I>(std::index_sequence<I...>)
+    {
+      return std::array<replay_function, sizeof...(I)>{
+          &capture_reader::run_command<std::variant_alternative_t<I, Action>, Backend>...};
+    }(std::make_index_sequence<std::variant_size_v<Action>>{});
+
+    if (header.command >= table.size())
+      return false;
+    return table[header.command](*this, backend, header, offset, handles);
+  }
+
+  template <typename C, typename Backend>
+  static bool run_command(
+      capture_reader& self, Backend& backend, const capture_format::record_header& header,
+      std::size_t offset, std::vector<void*>& handles)
+  {
+    // CPU work never reaches the backend, and so is never recorded
+    if constexpr (requires { C::cpu; })
+      return false;
+    else
+      return replay_command<C>(self, backend, header, offset, handles);
+  }
+
+  template <typename C, typename Backend>
+  static bool replay_command(
+      capture_reader& self, Backend& backend, const capture_format::record_header& header,
+      std::size_t offset, std::vector<void*>& handles)
+  {
+    C command{};
+    const char* body = self.m_data + offset;
+    const char* const end = body + header.size;
+    bool ok = true;
+
+    auto read = [&](void* dst, std::size_t size)
+    {
+      if (body + size > end)
+      {
+        ok = false;
+        return;
+      }
+      std::memcpy(dst, body, size);
+      body += size;
+    };
+
+    boost::pfr::for_each_field(
+        command,
+        [&]<typename F>(F& field)
+        {
+          if constexpr (capture_format::is_handle<F>)
+          {
+            std::uint32_t id{};
+            read(&id, sizeof(id));
+            field = id < handles.size() ? static_cast<F>(handles[id]) : nullptr;
+          }
+          else if constexpr (std::is_same_v<F, void*>)
+          {
+            std::uint32_t size{};
+            read(&size, sizeof(size));
+            while (std::size_t(body - self.m_data) % capture_format::payload_alignment != 0)
+              body++;
+            field = size > 0 && body + size <= end ? const_cast<char*>(body) : nullptr;
+            body += size;
+          }
+          else if constexpr (capture_format::is_optional<F>)
+          {
+            std::uint8_t has{};
+            typename F::value_type value{};
+            read(&has, sizeof(has));
+            read(&value, sizeof(value));
+            field = has ? F{value} : F{};
+          }
+          else
+          {
+            read(&field, sizeof(field));
+          }
+        });
+
+    if (!ok || body > end)
+      return false;
+
+    if constexpr (std::is_void_v<typename C::return_type>)
+    {
+      backend(command);
+    }
+    else
+    {
+      auto result = backend(command);
+      if (header.result > 0)
+      {
+        if (handles.size() <= header.result)
+          handles.resize(header.result + 1);
+        handles[header.result] = const_cast<void*>(capture_format::result_handle(result));
+      }
+    }
+    return true;
+  }
+
+  char* m_data{};
+  std::size_t m_size{};
+};
+}
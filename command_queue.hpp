@@ -0,0 +1,291 @@
+#pragma once
+#include "helpers.hpp"
+#include "cpu_tasks.hpp"
+#include "input_tracking.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <optional>
+#include <variant>
+#include <vector>
+
+// Moving commands between the thread running the nodes' coroutines
+// (the control thread) and the thread submitting to the GPU (the render
+// thread), without either of them ever taking a lock or waiting for the other.
+namespace gpu
+{
+// Bounded, lock-free single-producer / single-consumer ring.
+// Each side caches the other side's index so that the shared atomics are
+// only read when the ring looks full (or empty).
+template <typename T, std::size_t Capacity>
+class spsc_queue
+{
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "capacity must be a power of two");
+
+public:
+  static constexpr std::size_t capacity = Capacity;
+
+  // Producer side
+  bool try_push(const T& value) noexcept(std::is_nothrow_copy_assignable_v<T>)
+  {
+    const auto tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_cached_head == Capacity)
+    {
+      m_cached_head = m_head.load(std::memory_order_acquire);
+      if (tail - m_cached_head == Capacity)
+        return false;
+    }
+
+    m_storage[tail & (Capacity - 1)] = value;
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side
+  bool try_pop(T& value) noexcept(std::is_nothrow_move_assignable_v<T>)
+  {
+    const auto head = m_head.load(std::memory_order_relaxed);
+    if (head == m_cached_tail)
+    {
+      m_cached_tail = m_tail.load(std::memory_order_acquire);
+      if (head == m_cached_tail)
+        return false;
+    }
+
+    value = std::move(m_storage[head & (Capacity - 1)]);
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Approximate when called concurrently
+  std::size_t size() const noexcept
+  {
+    return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+  }
+
+private:
+  static constexpr std::size_t cache_line = 64;
+
+  // Written by the consumer
+  alignas(cache_line) std::atomic<std::size_t> m_head{};
+  std::size_t m_cached_tail{};
+
+  // Written by the producer
+  alignas(cache_line) std::atomic<std::size_t> m_tail{};
+  std::size_t m_cached_head{};
+
+  alignas(cache_line) T m_storage[Capacity]{};
+};
+
+// Whether the coroutine which yielded a command has to wait for the render
+// thread before going on: either it expects a result, or the command
+// points to memory owned by the node which must stay untouched until read.
+template <typename Action>
+bool needs_acknowledgement(const Action& action) noexcept
+{
+  return std::visit(
+      []<typename C>(const C& cmd)
+      { return !std::is_void_v<typename C::return_type> || requires { cmd.data; }; },
+      action);
+}
+
+// The two rings between the control and render threads:
+// commands one way, results of the commands which need them the other way.
+template <typename Action, typename Feedback, std::size_t Capacity = 256>
+class command_channel
+{
+public:
+  struct command
+  {
+    std::uint32_t ticket{};
+    bool acknowledge{};
+    Action action{};
+  };
+
+  struct feedback
+  {
+    std::uint32_t ticket{};
+    Feedback value{};
+  };
+
+  spsc_queue<command, Capacity> commands;
+  spsc_queue<feedback, Capacity> feedbacks;
+
+  // Render thread: runs every pending command on the backend.
+  // Returns the number of commands executed.
+  template <typename Backend>
+  int consume(Backend& backend)
+  {
+    // The feedback ring was full last time: retry before going on,
+    // so that results are delivered in order.
+    if (m_pending && !feedbacks.try_push(*m_pending))
+      return 0;
+    m_pending.reset();
+
+    int count = 0;
+    command cmd;
+    while (commands.try_pop(cmd))
+    {
+      count++;
+      auto result = gpu::execute<Feedback>(backend, cmd.action);
+      if (!cmd.acknowledge)
+        continue;
+
+      feedback fb{.ticket = cmd.ticket, .value = std::move(result)};
+      if (!feedbacks.try_push(fb))
+      {
+        m_pending = std::move(fb);
+        break;
+      }
+    }
+    return count;
+  }
+
+private:
+  std::optional<feedback> m_pending;
+};
+
+// Control thread: steps coroutines such as a node's update() or dispatch()
+// and pushes what they yield into a command_channel.
+// A coroutine which yielded a command needing an acknowledgement stays
+// parked until the render thread sent it back ; the others keep running.
+// CPU work never goes to the render thread: it runs on the pool if there is
+// one, with the coroutine parked until it completes, else in place.
+template <typename Action, typename Feedback, std::size_t Capacity = 256>
+class command_producer
+{
+public:
+  using generator_type = gpu::generator<Action, Feedback>;
+  using channel_type = command_channel<Action, Feedback, Capacity>;
+
+  explicit command_producer(channel_type& channel, thread_pool* pool = nullptr)
+      : m_channel{channel}
+      , m_pool{pool}
+  {
+  }
+
+  command_producer(const command_producer&) = delete;
+  command_producer& operator=(const command_producer&) = delete;
+
+  // The work still in flight references the coroutine frames
+  ~command_producer()
+  {
+    for (auto& t : m_tasks)
+      if (t.work)
+        t.work->wait();
+  }
+
+  void run(generator_type coroutine)
+  {
+    m_tasks.push_back(task{std::move(coroutine), {}, {}, {}});
+  }
+
+  // Runs a node's update(), if gpu::update_required() says it has to
+  template <typename Node>
+  void run_update(Node& node)
+  {
+    if (update_required(node))
+      run(node.update());
+  }
+
+  // Delivers the results received so far and advances every coroutine
+  // as far as possible. Returns the number of coroutines still in flight.
+  int poll()
+  {
+    typename channel_type::feedback fb;
+    while (m_channel.feedbacks.try_pop(fb))
+    {
+      for (auto& t : m_tasks)
+      {
+        if (t.awaiting && *t.awaiting == fb.ticket)
+        {
+          (**t.iterator).feedback_value = std::move(fb.value);
+          t.awaiting.reset();
+          ++*t.iterator;
+          break;
+        }
+      }
+    }
+
+    for (auto& t : m_tasks)
+    {
+      if (t.work && t.work->wait_for(std::chrono::seconds{0}) == std::future_status::ready)
+      {
+        // Rethrows what the work threw, on the control thread
+        std::exchange(t.work, std::nullopt)->get();
+        ++*t.iterator;
+      }
+      if (!t.awaiting && !t.work)
+        step(t);
+    }
+
+    std::erase_if(m_tasks, [](const task& t) { return t.done(); });
+    return m_tasks.size();
+  }
+
+private:
+  struct task
+  {
+    generator_type coroutine;
+    std::optional<typename generator_type::iterator> iterator;
+    std::optional<std::uint32_t> awaiting;
+    std::optional<std::future<void>> work;
+
+    bool done() const noexcept
+    {
+      return iterator && *iterator == std::default_sentinel && !awaiting && !work;
+    }
+  };
+
+  void step(task& t)
+  {
+    if (!t.iterator)
+      t.iterator.emplace(t.coroutine.begin());
+
+    while (*t.iterator != std::default_sentinel)
+    {
+      auto& promise = **t.iterator;
+      if (auto job = std::get_if<cpu_task>(&promise.current_command))
+      {
+        if (m_pool)
+        {
+          t.work = m_pool->submit(*job);
+          return;
+        }
+        (*job)();
+        ++*t.iterator;
+        continue;
+      }
+
+      const bool acknowledge = needs_acknowledgement(promise.current_command);
+      const auto ticket = m_next_ticket;
+
+      // Ring full: the command will be pushed on the next poll
+      if (!m_channel.commands.try_push(
+              {.ticket = ticket, .acknowledge = acknowledge, .action = promise.current_command}))
+        return;
+
+      m_next_ticket++;
+      if (acknowledge)
+      {
+        t.awaiting = ticket;
+        return;
+      }
+      ++*t.iterator;
+    }
+  }
+
+  channel_type& m_channel;
+  thread_pool* m_pool{};
+  std::vector<task> m_tasks;
+  std::uint32_t m_next_ticket{};
+};
+
+using update_channel = command_channel<update_action, update_handle>;
+using update_producer = command_producer<update_action, update_handle>;
+using dispatch_channel = command_channel<dispatch_action, dispatch_handle>;
+using dispatch_producer = command_producer<dispatch_action, dispatch_handle>;
+}
@@ -0,0 +1,181 @@
+// Measures what layout reflection costs the compiler: generates
+// translation units with N synthetic nodes, and compiles each one with
+// the structured-binding reflection of reflection.hpp, then through
+// boost::pfr, reporting the compile time and the compiler's peak memory.
+//
+//   gpp_compile_bench <compiler> <N,N,...> [compiler flags...]
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+// A graphics node and a compute node, alternately, each with the kinds
+// of members the helpers reflect over
+void write_node(std::ofstream& out, int i)
+{
+  const std::string n = std::to_string(i);
+  out << "struct node_" << n << "\n{\n";
+  if (i % 2 == 0)
+  {
+    out << "  enum { graphics };\n"
+           "  struct vertex_input\n  {\n"
+           "    gpp_attribute(0, v_position, float[3], position) pos;\n"
+           "    gpp_attribute(1, v_texcoord, float[2], texcoord) tex;\n"
+           "    gpp_attribute(2, v_color, gpu::unorm16[4], color) color;\n"
+           "  } vertex_input;\n"
+           "  struct fragment_output\n  {\n"
+           "    gpp_attribute(0, frag_color, float[4], color) color;\n"
+           "  } fragment_output;\n";
+  }
+  else
+  {
+    out << "  halp_flags(compute);\n"
+           "  struct specialization\n  {\n"
+           "    gpu::local_size_constant<'x', 0, 16> local_size_x;\n"
+           "    gpu::local_size_constant<'y', 1, 16> local_size_y;\n"
+           "    gpu::local_size_constant<'z', 2, 1> local_size_z;\n"
+           "    gpu::specialization_constant<\"k"
+        << n << "\", int, 3, " << n << "> k;\n"
+           "  } specialization;\n";
+  }
+
+  out << "  struct params\n  {\n"
+         "    halp_meta(name, \"params\");\n"
+         "    halp_meta(binding, 0);\n"
+         "    halp_flags(std140, ubo);\n"
+         "    gpu::uniform<\"a\", float> a;\n"
+         "    gpu::uniform<\"b\", int> b;\n"
+         "    gpu::uniform<\"c\", float[2]> c;\n"
+         "    gpu::uniform<\"d\", float[4]> d;\n"
+         "    gpu::uniform<\"e\", float[3]> e;\n"
+         "    gpu::uniform<\"f\", float> f;\n"
+         "  };\n"
+         "  struct bindings\n  {\n"
+         "    params ubo;\n"
+         "    struct\n    {\n"
+         "      halp_meta(name, \"data\");\n"
+         "      halp_meta(binding, 1);\n"
+         "      halp_flags(std430, buffer, load, store);\n"
+         "      gpu::uniform<\"values\", float*> values;\n"
+         "    } buf;\n"
+         "    struct\n    {\n"
+         "      halp_meta(name, \"img\");\n"
+         "      halp_meta(format, gpu::texture_format::rgba8);\n"
+         "      halp_meta(binding, 2);\n"
+         "      halp_flags(image2D, readonly);\n"
+         "    } image;\n"
+         "  } bindings;\n"
+         "};\n";
+
+  out << "static_assert(gpu::descriptors<node_" << n << ">.size() > 0);\n"
+      << "static_assert(gpu::first_free_binding<decltype(node_" << n
+      << "::bindings)>() == 3);\n"
+      << "static_assert(gpu::field_index<&node_" << n << "::params::e>() == 4);\n";
+  if (i % 2 == 0)
+    out << "static_assert(gpu::vertex_packer<decltype(node_" << n
+        << "::vertex_input)>::stride == 28);\n";
+  else
+    out << "static_assert(gpu::specialization_entries<decltype(node_" << n
+        << "::specialization)>().size() == 4);\n";
+  out << "\n";
+}
+
+std::string generate(int nodes)
+{
+  std::string path = "gpp_bench_" + std::to_string(nodes) + ".cpp";
+  std::ofstream out{path};
+  out << "#include \"descriptors.hpp\"\n"
+         "#include \"specialization.hpp\"\n"
+         "#include \"vertex_packer.hpp\"\n\n";
+  for (int i = 0; i < nodes; i++)
+    write_node(out, i);
+  return path;
+}
+
+struct measure
+{
+  bool ok{};
+  double seconds{};
+  long peak_kb{};
+};
+
+// The peak memory is the one of the largest process, e.g. cc1plus:
+// wait4 accounts for the children of the compiler driver too
+measure compile(std::vector<std::string> args)
+{
+  std::vector<char*> argv;
+  for (auto& a : args)
+    argv.push_back(a.data());
+  argv.push_back(nullptr);
+
+  const auto start = std::chrono::steady_clock::now();
+  const pid_t pid = fork();
+  if (pid == 0)
+  {
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+
+  int status{};
+  rusage usage{};
+  if (pid < 0 || wait4(pid, &status, 0, &usage) < 0)
+    return {};
+
+  return measure{
+      .ok = WIFEXITED(status) && WEXITSTATUS(status) == 0,
+      .seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+      .peak_kb = usage.ru_maxrss};
+}
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 3)
+  {
+    std::fprintf(stderr, "usage: %s <compiler> <N,N,...> [compiler flags...]\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<int> counts;
+  for (std::string_view list = argv[2]; !list.empty();)
+  {
+    const auto comma = list.find(',');
+    counts.push_back(std::stoi(std::string(list.substr(0, comma))));
+    list = comma == list.npos ? std::string_view{} : list.substr(comma + 1);
+  }
+
+  std::printf("%8s  %-12s %10s %10s\n", "nodes", "reflection", "seconds", "peak MB");
+  int failures = 0;
+  for (int nodes : counts)
+  {
+    const std::string source = generate(nodes);
+    for (const bool pfr : {false, true})
+    {
+      std::vector<std::string> args{argv[1]};
+      args.insert(args.end(), argv + 3, argv + argc);
+      if (pfr)
+        args.push_back("-DGPP_REFLECTION_PFR");
+      args.insert(args.end(), {"-c", source, "-o", "/dev/null"});
+
+      const measure m = compile(std::move(args));
+      if (!m.ok)
+      {
+        std::fprintf(stderr, "%s did not compile\n", source.c_str());
+        failures++;
+        continue;
+      }
+      std::printf(
+          "%8d  %-12s %10.2f %10.1f\n", nodes, pfr ? "boost::pfr" : "aggregate", m.seconds,
+          m.peak_kb / 1024.);
+    }
+  }
+  return failures > 0;
+}
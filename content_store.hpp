@@ -0,0 +1,349 @@
+#pragma once
+#include "descriptors.hpp"
+#include "helpers.hpp"
+#include <boost/pfr/core.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace gpu
+{
+// MurmurHash64A
+inline std::uint64_t content_hash(const void* data, std::size_t size) noexcept
+{
+  constexpr std::uint64_t m = 0xc6a4a7935bd1e995ull;
+  constexpr int r = 47;
+
+  std::uint64_t h = 0x9e3779b97f4a7c15ull ^ (size * m);
+  auto bytes = static_cast<const unsigned char*>(data);
+  const std::size_t blocks = size / 8;
+  for (std::size_t i = 0; i < blocks; i++)
+  {
+    std::uint64_t k;
+    std::memcpy(&k, bytes + i * 8, 8);
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  const auto tail = bytes + blocks * 8;
+  switch (size & 7)
+  {
+    case 7: h ^= std::uint64_t(tail[6]) << 48; [[fallthrough]];
+    case 6: h ^= std::uint64_t(tail[5]) << 40; [[fallthrough]];
+    case 5: h ^= std::uint64_t(tail[4]) << 32; [[fallthrough]];
+    case 4: h ^= std::uint64_t(tail[3]) << 24; [[fallthrough]];
+    case 3: h ^= std::uint64_t(tail[2]) << 16; [[fallthrough]];
+    case 2: h ^= std::uint64_t(tail[1]) << 8; [[fallthrough]];
+    case 1: h ^= std::uint64_t(tail[0]); h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+// Sits in front of a backend and deduplicates static and immutable buffers
+// by content: identical payloads, whichever node uploads them, map to a
+// single reference-counted backend buffer.
+//
+// Immutable buffers are looked up as soon as they are allocated.
+// Static buffers get a placeholder handle, which is bound to shared content
+// once a whole-buffer upload gives its bytes. Uploading again into a shared
+// buffer, or letting the device write into it (copies, storage bindings),
+// gives the node its own copy first.
+// Handles in every other command are translated before reaching the backend.
+//
+// Shaders may also write into storage buffers through the layout's own
+// bindings, which no command shows: static buffers allocated at a binding
+// the layout flags with "store" are never shared. The host tells which
+// layout the following commands come from with begin<Layout>() ; until
+// then, no static buffer is shared.
+template <typename Backend>
+class content_store
+{
+public:
+  struct statistics
+  {
+    int resources{};
+    int references{};
+    std::size_t bytes_saved{};
+  };
+
+  explicit content_store(Backend& backend)
+      : m_backend{backend}
+  {
+  }
+
+  content_store(const content_store&) = delete;
+  content_store& operator=(const content_store&) = delete;
+
+  template <typename Layout>
+  void begin() noexcept
+  {
+    m_writable = writable_bindings<Layout>();
+  }
+  void end() noexcept { m_writable = all_bindings; }
+
+  template <typename C>
+  typename C::return_type operator()(const C& command)
+  {
+    if constexpr (requires { C::allocation; C::immutable; })
+    {
+      auto& c = acquire(command.binding, command.data, command.size);
+      m_immutables[c.handle] = &c;
+      return c.handle;
+    }
+    else if constexpr (requires { C::allocation; C::static_; })
+    {
+      if (writable(command.binding))
+        return m_backend(command);
+
+      auto p = std::make_unique<placeholder>();
+      p->binding = command.binding;
+      p->size = command.size;
+      auto handle = reinterpret_cast<buffer_handle>(p.get());
+      m_placeholders.emplace(handle, std::move(p));
+      return handle;
+    }
+    else if constexpr (requires { C::upload; C::static_; })
+    {
+      auto it = m_placeholders.find(command.handle);
+      if (it == m_placeholders.end())
+        return m_backend(command);
+
+      auto& p = *it->second;
+      if (command.offset < 0 || command.size < 0 || command.offset + command.size > p.size)
+        throw std::out_of_range{"upload outside of the buffer"};
+
+      if (p.shared)
+      {
+        // Copy on write: the new content may well be shared too
+        std::string bytes = p.shared->bytes;
+        std::memcpy(bytes.data() + command.offset, command.data, command.size);
+        release(p.shared);
+        p.shared = &acquire(p.binding, bytes.data(), bytes.size());
+      }
+      else if (!p.own && command.offset == 0 && command.size == p.size)
+      {
+        p.shared = &acquire(p.binding, command.data, command.size);
+      }
+      else
+      {
+        auto upload = command;
+        upload.handle = own(p);
+        m_backend(upload);
+      }
+    }
+    else if constexpr (requires { C::deallocation; })
+    {
+      if constexpr (std::is_same_v<decltype(command.handle), buffer_handle>)
+      {
+        if (auto it = m_placeholders.find(command.handle); it != m_placeholders.end())
+        {
+          auto& p = *it->second;
+          if (p.shared)
+            release(p.shared);
+          if (p.own)
+            m_backend(buffer_release{.handle = p.own});
+          m_placeholders.erase(it);
+          return;
+        }
+
+        if (auto it = m_immutables.find(command.handle); it != m_immutables.end())
+        {
+          release(it->second);
+          return;
+        }
+      }
+      return m_backend(command);
+    }
+    else if constexpr (requires { C::copy; C::buffer_to_buffer; })
+    {
+      auto copy = command;
+      copy.src = resolve(copy.src);
+      copy.dst = resolve_for_write(copy.dst);
+      return m_backend(copy);
+    }
+    else if constexpr (requires { C::copy; C::texture_to_buffer; })
+    {
+      auto copy = command;
+      copy.dst = resolve_for_write(copy.dst);
+      return m_backend(copy);
+    }
+    else if constexpr (requires { C::compute; C::bind; C::buffer; })
+    {
+      // Storage bindings may be written to
+      auto bind = command;
+      bind.handle = resolve_for_write(bind.handle);
+      return m_backend(bind);
+    }
+    else
+    {
+      auto translated = command;
+      boost::pfr::for_each_field(
+          translated,
+          [this]<typename F>(F& field)
+          {
+            if constexpr (std::is_same_v<F, buffer_handle>)
+              field = resolve(field);
+          });
+      return m_backend(translated);
+    }
+  }
+
+  statistics stats() const noexcept
+  {
+    statistics s;
+    for (const auto& [hash, c] : m_contents)
+    {
+      s.resources++;
+      s.references += c->references;
+      s.bytes_saved += (c->references - 1) * c->bytes.size();
+    }
+    return s;
+  }
+
+private:
+  static constexpr std::uint64_t all_bindings = ~std::uint64_t{};
+
+  template <typename Layout>
+  static constexpr std::uint64_t writable_bindings() noexcept
+  {
+    std::uint64_t mask = 0;
+    for (const auto& d : descriptors<Layout>)
+    {
+      if (d.kind == descriptor_kind::storage_buffer && (d.access & write_access))
+        mask |= d.binding < 64 ? std::uint64_t{1} << d.binding : all_bindings;
+    }
+    return mask;
+  }
+
+  // Negative bindings are the host's own buffers, never seen by shaders
+  bool writable(int binding) const noexcept
+  {
+    return binding >= 0 && (binding >= 64 || (m_writable >> binding) & 1);
+  }
+
+  struct content
+  {
+    std::uint64_t hash{};
+    buffer_handle handle{};
+    int references{};
+
+    // Kept for collision checks and copy-on-write
+    std::string bytes;
+  };
+
+  // What a node gets for a static allocation
+  struct placeholder
+  {
+    int binding{};
+    int size{};
+    content* shared{};
+    buffer_handle own{};
+  };
+
+  content& acquire(int binding, const void* data, std::size_t size)
+  {
+    const auto hash = content_hash(data, size);
+    const std::string_view bytes{static_cast<const char*>(data), size};
+
+    auto [begin, end] = m_contents.equal_range(hash);
+    for (auto it = begin; it != end; ++it)
+    {
+      if (it->second->bytes == bytes)
+      {
+        it->second->references++;
+        return *it->second;
+      }
+    }
+
+    auto c = std::make_unique<content>();
+    c->hash = hash;
+    c->references = 1;
+    c->bytes = bytes;
+    c->handle = m_backend(static_allocation{.binding = binding, .size = int(size)});
+    m_backend(static_upload{
+        .handle = c->handle,
+        .offset = 0,
+        .size = int(size),
+        .data = c->bytes.data()});
+
+    return *m_contents.emplace(hash, std::move(c))->second;
+  }
+
+  void release(content* c)
+  {
+    if (--c->references > 0)
+      return;
+
+    m_backend(buffer_release{.handle = c->handle});
+    m_immutables.erase(c->handle);
+
+    auto [begin, end] = m_contents.equal_range(c->hash);
+    for (auto it = begin; it != end; ++it)
+    {
+      if (it->second.get() == c)
+      {
+        m_contents.erase(it);
+        break;
+      }
+    }
+  }
+
+  // The buffer of a placeholder that is not shared
+  buffer_handle own(placeholder& p)
+  {
+    if (!p.own)
+      p.own = m_backend(static_allocation{.binding = p.binding, .size = p.size});
+    return p.own;
+  }
+
+  buffer_handle resolve(buffer_handle handle)
+  {
+    auto it = m_placeholders.find(handle);
+    if (it == m_placeholders.end())
+      return handle;
+
+    auto& p = *it->second;
+    return p.shared ? p.shared->handle : own(p);
+  }
+
+  buffer_handle resolve_for_write(buffer_handle handle)
+  {
+    auto it = m_placeholders.find(handle);
+    if (it == m_placeholders.end())
+      return handle;
+
+    auto& p = *it->second;
+    if (p.shared)
+    {
+      auto shared = std::exchange(p.shared, nullptr);
+      m_backend(static_upload{
+          .handle = own(p),
+          .offset = 0,
+          .size = p.size,
+          .data = shared->bytes.data()});
+      release(shared);
+    }
+    return own(p);
+  }
+
+  Backend& m_backend;
+  std::unordered_multimap<std::uint64_t, std::unique_ptr<content>> m_contents;
+  std::unordered_map<buffer_handle, std::unique_ptr<placeholder>> m_placeholders;
+  std::unordered_map<buffer_handle, content*> m_immutables;
+  std::uint64_t m_writable{all_bindings};
+};
+}
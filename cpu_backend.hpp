@@ -0,0 +1,549 @@
+#pragma once
+#include "helpers.hpp"
+#include "mipmaps.hpp"
+#include "reduction.hpp"
+#include "staging.hpp"
+#include "texture_conversion.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+namespace gpu
+{
+// Executes the commands on the CPU: resources are plain memory.
+// Shaders cannot run here, so dispatches call a user-provided kernel ;
+// everything else (allocations, uploads, copies, readbacks, reductions...)
+// behaves like it would on the device, which makes it possible to test
+// command streams without a GPU.
+class cpu_backend
+{
+public:
+  struct buffer
+  {
+    int binding{};
+    std::vector<char> data;
+  };
+
+  // Layers are stored one after the other, each with its mip chain.
+  struct texture
+  {
+    int binding{};
+    int width{};
+    int height{};
+    int array_layers{1};
+    int mip_levels{1};
+    texture_format format{texture_format::rgba8};
+    int bytes_per_pixel{4};
+    std::vector<char> data;
+
+    int level_width(int mip) const noexcept { return std::max(1, width >> mip); }
+    int level_height(int mip) const noexcept { return std::max(1, height >> mip); }
+    std::size_t level_size(int mip) const noexcept
+    {
+      return std::size_t(level_width(mip)) * level_height(mip) * bytes_per_pixel;
+    }
+
+    std::size_t layer_size() const noexcept
+    {
+      std::size_t sz = 0;
+      for (int mip = 0; mip < mip_levels; mip++)
+        sz += level_size(mip);
+      return sz;
+    }
+
+    std::size_t subresource_offset(int layer, int mip) const noexcept
+    {
+      std::size_t offset = layer * layer_size();
+      for (int m = 0; m < mip; m++)
+        offset += level_size(m);
+      return offset;
+    }
+
+    char* subresource(int layer, int mip) noexcept
+    {
+      return data.data() + subresource_offset(layer, mip);
+    }
+  };
+
+  // Called for each direct or indirect dispatch with the group counts
+  std::function<void(cpu_backend&, int x, int y, int z)> kernel;
+
+  // Splits the larger mip levels of generate_mips across its workers,
+  // when set
+  thread_pool* workers{};
+
+  // Storage buffer ranges bound by bind_buffer, for the kernel to use
+  std::map<int, std::span<char>> bound_buffers;
+
+  // Textures bound by bind_texture
+  std::map<int, texture*> bound_textures;
+
+  // The push_constant block, as set by set_push_constants
+  std::vector<char> push_constants;
+
+  template <typename T>
+  T push_constant(int offset) const noexcept
+  {
+    T value{};
+    if (offset + sizeof(T) <= push_constants.size())
+      std::memcpy(&value, push_constants.data() + offset, sizeof(T));
+    return value;
+  }
+
+  buffer& get(buffer_handle handle) noexcept
+  {
+    return *reinterpret_cast<buffer*>(handle);
+  }
+
+  texture& get(texture_handle handle) noexcept
+  {
+    return *reinterpret_cast<texture*>(handle);
+  }
+
+  // Once the frame has been submitted: recycles the staging memory
+  void end_frame() { m_staging.reset(); }
+
+  // Whether an upload payload is staging memory, valid until end_frame()
+  bool owns_staging(const void* ptr) const noexcept { return m_staging.owns(ptr); }
+
+  template <typename C>
+  typename C::return_type operator()(const C& command)
+  {
+    if constexpr (requires { C::allocation; C::texture; })
+    {
+      auto& tex = create_texture();
+      tex.binding = command.binding;
+      tex.width = command.width;
+      tex.height = command.height;
+      tex.array_layers = std::max(1, command.array_layers);
+      tex.format = command.format;
+      tex.bytes_per_pixel = gpu::bytes_per_pixel(command.format);
+      tex.mip_levels = command.mip_levels > 0
+                           ? command.mip_levels
+                           : mip_level_count(command.width, command.height);
+      tex.data.resize(tex.layer_size() * tex.array_layers);
+      return reinterpret_cast<texture_handle>(&tex);
+    }
+    else if constexpr (requires { C::allocation; C::sampler; })
+    {
+      return reinterpret_cast<sampler_handle>(&m_sampler);
+    }
+    else if constexpr (requires { C::allocation; C::staging; })
+    {
+      return m_staging.allocate(command.size, command.align);
+    }
+    else if constexpr (requires { C::allocation; })
+    {
+      auto& buf = create_buffer();
+      buf.binding = command.binding;
+      buf.data.resize(command.size);
+      if constexpr (requires { C::immutable; })
+        std::memcpy(buf.data.data(), command.data, command.size);
+      if constexpr (requires { C::ubo; })
+        m_ubos[command.binding] = &buf;
+      return reinterpret_cast<buffer_handle>(&buf);
+    }
+    else if constexpr (requires { C::upload; C::texture; })
+    {
+      auto& tex = get(command.handle);
+      if (command.width > 0 && command.height > 0)
+        write_region(tex, command);
+      else if (command.data_format || command.premultiply)
+        write_converted(tex, command);
+      else
+        write(tex.data, command.offset, command.data, command.size);
+    }
+    else if constexpr (requires { C::upload; })
+    {
+      auto& buf = get(command.handle);
+      write(buf.data, command.offset, command.data, command.size);
+    }
+    else if constexpr (requires { C::mipmaps; C::texture; })
+    {
+      auto& tex = get(command.handle);
+      for (int layer = 0; layer < tex.array_layers; layer++)
+      {
+        for (int mip = 1; mip < tex.mip_levels; mip++)
+        {
+          mipmaps::downsample(
+              tex.subresource(layer, mip - 1),
+              tex.level_width(mip - 1),
+              tex.level_height(mip - 1),
+              tex.subresource(layer, mip),
+              tex.format,
+              workers);
+        }
+      }
+    }
+    else if constexpr (requires { C::getter; C::ubo; })
+    {
+      auto& buf = m_ubos[command.binding];
+      if (!buf)
+      {
+        buf = &create_buffer();
+        buf->binding = command.binding;
+      }
+      return reinterpret_cast<buffer_handle>(buf);
+    }
+    else if constexpr (requires { C::getter; C::texture; })
+    {
+      auto& tex = m_textures_by_binding[command.binding];
+      if (!tex)
+      {
+        tex = &create_texture();
+        tex->binding = command.binding;
+      }
+      return reinterpret_cast<texture_handle>(tex);
+    }
+    else if constexpr (requires { C::deallocation; })
+    {
+      release(command.handle);
+    }
+    else if constexpr (requires { C::compute; C::begin; })
+    {
+      bound_buffers.clear();
+      bound_textures.clear();
+    }
+    else if constexpr (requires { C::compute; C::end; })
+    {
+    }
+    else if constexpr (requires { C::compute; C::dispatch; C::indirect; })
+    {
+      std::uint32_t groups[3]{};
+      std::memcpy(groups, get(command.handle).data.data() + command.offset, sizeof(groups));
+      if (kernel)
+        kernel(*this, groups[0], groups[1], groups[2]);
+    }
+    else if constexpr (requires { C::compute; C::dispatch; })
+    {
+      if (kernel)
+        kernel(*this, command.x, command.y, command.z);
+    }
+    else if constexpr (requires { C::compute; C::bind; C::buffer; })
+    {
+      auto& buf = get(command.handle);
+      bound_buffers[command.binding]
+          = std::span<char>{buf.data.data() + command.offset, std::size_t(command.size)};
+    }
+    else if constexpr (requires { C::compute; C::bind; C::texture; })
+    {
+      bound_textures[command.binding] = &get(command.handle);
+    }
+    else if constexpr (requires { C::compute; C::reduce; C::buffer; })
+    {
+      // Shaders do not run here: use the reference implementation,
+      // which sums in the same order as the device.
+      using value_type = reduction::value_type;
+      auto& buf = get(command.handle);
+      const auto sum = reduction::reference(
+          reinterpret_cast<const value_type*>(buf.data.data()), command.count);
+
+      auto& readback = create_readback();
+      readback.resize(sizeof(sum));
+      std::memcpy(readback.data(), sum.data(), sizeof(sum));
+      return {.handle = reinterpret_cast<buffer_readback_handle>(&readback)};
+    }
+    else if constexpr (requires { C::push_constants; })
+    {
+      write(push_constants, command.offset, command.data, command.size);
+    }
+    else if constexpr (requires { C::pipeline; C::specialization; })
+    {
+    }
+    else if constexpr (requires { C::copy; C::buffer_to_buffer; })
+    {
+      auto& src = get(command.src);
+      auto& dst = get(command.dst);
+      check_range(src.data.size(), command.src_offset, command.size);
+      check_range(dst.data.size(), command.dst_offset, command.size);
+      std::memmove(
+          dst.data.data() + command.dst_offset,
+          src.data.data() + command.src_offset,
+          command.size);
+    }
+    else if constexpr (requires { C::copy; C::texture_to_buffer; })
+    {
+      auto& src = get(command.src);
+      auto& dst = get(command.dst);
+      const auto rect = copy_region(src, command);
+      check_range(dst.data.size(), command.dst_offset, command.size);
+      copy_rows(
+          src, command.mip_level, command.array_layer, rect,
+          [&](char* pixels, std::size_t packed, std::size_t bytes)
+          { std::memcpy(dst.data.data() + command.dst_offset + packed, pixels, bytes); });
+    }
+    else if constexpr (requires { C::copy; C::buffer_to_texture; })
+    {
+      auto& src = get(command.src);
+      auto& dst = get(command.dst);
+      const auto rect = copy_region(dst, command);
+      check_range(src.data.size(), command.src_offset, command.size);
+      copy_rows(
+          dst, command.mip_level, command.array_layer, rect,
+          [&](char* pixels, std::size_t packed, std::size_t bytes)
+          { std::memcpy(pixels, src.data.data() + command.src_offset + packed, bytes); });
+    }
+    else if constexpr (requires { C::readback; C::request; C::buffer; })
+    {
+      auto& buf = get(command.handle);
+      auto& readback = create_readback();
+      readback.assign(
+          buf.data.begin() + command.offset,
+          buf.data.begin() + command.offset + command.size);
+      return {.handle = reinterpret_cast<buffer_readback_handle>(&readback)};
+    }
+    else if constexpr (requires { C::readback; C::request; C::texture; })
+    {
+      auto& tex = get(command.handle);
+      auto& readback = create_readback();
+      if (command.width > 0 && command.height > 0)
+        read_region(tex, command, readback);
+      else
+        readback.assign(tex.data.begin(), tex.data.begin() + tex.level_size(0));
+      return {.handle = reinterpret_cast<texture_readback_handle>(&readback)};
+    }
+    else if constexpr (requires { C::readback; C::await; })
+    {
+      // The data stays there until the next readback request
+      auto readback = reinterpret_cast<std::vector<char>*>(command.handle);
+      if (std::find(m_free_readbacks.begin(), m_free_readbacks.end(), readback)
+          == m_free_readbacks.end())
+        m_free_readbacks.push_back(readback);
+      return {.data = readback->data(), .size = readback->size()};
+    }
+    else if constexpr (requires { C::query; C::timestamp; })
+    {
+      // Commands run synchronously here: they are all complete already
+      auto& q = create_query();
+      q.end = now();
+      q.ended = true;
+      return reinterpret_cast<query_handle>(&q);
+    }
+    else if constexpr (requires { C::query; C::begin; })
+    {
+      auto& q = create_query();
+      q.begin = now();
+      return reinterpret_cast<query_handle>(&q);
+    }
+    else if constexpr (requires { C::query; C::end; })
+    {
+      auto& q = *reinterpret_cast<query*>(command.handle);
+      q.end = now();
+      q.ended = true;
+    }
+    else if constexpr (requires { C::query; C::await; })
+    {
+      auto& q = *reinterpret_cast<query*>(command.handle);
+      if (!q.ended)
+        return {.ready = false, .nanoseconds = 0};
+      const query_result result{.ready = true, .nanoseconds = q.end - q.begin};
+      m_free_queries.push_back(&q);
+      return result;
+    }
+    else
+    {
+      static_assert(std::is_void_v<typename C::return_type>, "unhandled command");
+    }
+  }
+
+private:
+  static void write(std::vector<char>& dst, int offset, const void* src, std::size_t size)
+  {
+    if (dst.size() < offset + size)
+      dst.resize(offset + size);
+    std::memcpy(dst.data() + offset, src, size);
+  }
+
+  // Converts from the upload's data format to the texture's,
+  // and premultiplies if requested
+  static void convert(
+      const texture& tex, const texture_upload& command,
+      const void* src, void* dst, std::size_t pixels)
+  {
+    const auto src_format = command.data_format.value_or(tex.format);
+    if (!convert_pixels(src, src_format, dst, tex.format, pixels))
+      throw std::invalid_argument{"unsupported texture format conversion"};
+    if (command.premultiply && !premultiply(dst, tex.format, pixels))
+      throw std::invalid_argument{"cannot premultiply a texture without alpha"};
+  }
+
+  static void write_converted(texture& tex, const texture_upload& command)
+  {
+    const auto src_format = command.data_format.value_or(tex.format);
+    const std::size_t pixels = command.size / gpu::bytes_per_pixel(src_format);
+    const std::size_t offset = command.offset;
+    if (tex.data.size() < offset + pixels * tex.bytes_per_pixel)
+      tex.data.resize(offset + pixels * tex.bytes_per_pixel);
+    convert(tex, command, command.data, tex.data.data() + offset, pixels);
+  }
+
+  static void write_region(texture& tex, const texture_upload& command)
+  {
+    const int bpp = tex.bytes_per_pixel;
+    const int src_bpp = gpu::bytes_per_pixel(command.data_format.value_or(tex.format));
+    const int level_width = tex.level_width(command.mip_level);
+    const int pitch = command.row_pitch > 0 ? command.row_pitch : command.width * src_bpp;
+
+    char* dst = tex.subresource(command.array_layer, command.mip_level);
+    auto src = static_cast<const char*>(command.data);
+    for (int row = 0; row < command.height; row++)
+    {
+      convert(
+          tex, command,
+          src + std::size_t(row) * pitch,
+          dst + (std::size_t(command.y + row) * level_width + command.x) * bpp,
+          command.width);
+    }
+  }
+
+  static void check_range(std::size_t size, int offset, int bytes)
+  {
+    if (offset < 0 || bytes < 0 || std::size_t(offset) + bytes > size)
+      throw std::out_of_range{"copy outside of the buffer"};
+  }
+
+  struct rect
+  {
+    int x{}, y{};
+    int width{}, height{};
+  };
+
+  // The rectangle of a texture level a copy covers, which must fit in the
+  // texture and hold exactly the bytes of the copy
+  template <typename C>
+  static rect copy_region(const texture& tex, const C& command)
+  {
+    if (command.mip_level < 0 || command.mip_level >= tex.mip_levels
+        || command.array_layer < 0 || command.array_layer >= tex.array_layers)
+      throw std::out_of_range{"copy outside of the texture's levels or layers"};
+
+    const int level_width = tex.level_width(command.mip_level);
+    const int level_height = tex.level_height(command.mip_level);
+    rect r{command.x, command.y, command.width, command.height};
+    if (r.width <= 0 || r.height <= 0)
+      r = {0, 0, level_width, level_height};
+
+    if (r.x < 0 || r.y < 0 || r.x + r.width > level_width || r.y + r.height > level_height
+        || tex.subresource_offset(command.array_layer, command.mip_level)
+                   + tex.level_size(command.mip_level)
+               > tex.data.size())
+      throw std::out_of_range{"copy outside of the texture"};
+    if (std::size_t(command.size) != std::size_t(r.width) * r.height * tex.bytes_per_pixel)
+      throw std::invalid_argument{"copy size does not match its region"};
+    return r;
+  }
+
+  // Calls f with each row of the rectangle in the texture, its offset in
+  // the tightly packed buffer, and its size
+  template <typename F>
+  static void copy_rows(texture& tex, int mip, int layer, rect r, F&& f)
+  {
+    const int bpp = tex.bytes_per_pixel;
+    const std::size_t row_bytes = std::size_t(r.width) * bpp;
+    char* level = tex.subresource(layer, mip);
+    for (int row = 0; row < r.height; row++)
+    {
+      f(level + (std::size_t(r.y + row) * tex.level_width(mip) + r.x) * bpp,
+        row * row_bytes, row_bytes);
+    }
+  }
+
+  static void read_region(texture& tex, const readback_texture& command, std::vector<char>& out)
+  {
+    const int bpp = tex.bytes_per_pixel;
+    const int level_width = tex.level_width(command.mip_level);
+    const int row_bytes = command.width * bpp;
+
+    out.resize(std::size_t(row_bytes) * command.height);
+    const char* src = tex.subresource(command.array_layer, command.mip_level);
+    for (int row = 0; row < command.height; row++)
+    {
+      std::memcpy(
+          out.data() + std::size_t(row) * row_bytes,
+          src + (std::size_t(command.y + row) * level_width + command.x) * bpp,
+          row_bytes);
+    }
+  }
+
+  struct query
+  {
+    std::uint64_t begin{};
+    std::uint64_t end{};
+    bool ended{};
+  };
+
+  static std::uint64_t now() noexcept
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  query& create_query()
+  {
+    if (m_free_queries.empty())
+      return *m_queries.emplace_back(std::make_unique<query>());
+    auto& q = *m_free_queries.back();
+    m_free_queries.pop_back();
+    return q = {};
+  }
+
+  buffer& create_buffer()
+  {
+    return *m_buffers.emplace_back(std::make_unique<buffer>());
+  }
+
+  texture& create_texture()
+  {
+    return *m_textures.emplace_back(std::make_unique<texture>());
+  }
+
+  // Readbacks are recycled once awaited, like queries
+  std::vector<char>& create_readback()
+  {
+    if (m_free_readbacks.empty())
+      return *m_readbacks.emplace_back(std::make_unique<std::vector<char>>());
+    auto& readback = *m_free_readbacks.back();
+    m_free_readbacks.pop_back();
+    readback.clear();
+    return readback;
+  }
+
+  template <typename T>
+  static void erase(std::vector<std::unique_ptr<T>>& vec, const void* handle)
+  {
+    std::erase_if(vec, [=](const auto& ptr) { return ptr.get() == handle; });
+  }
+
+  void release(buffer_handle handle)
+  {
+    std::erase_if(m_ubos, [=](const auto& ubo) { return ubo.second == (void*)handle; });
+    erase(m_buffers, handle);
+  }
+
+  void release(texture_handle handle)
+  {
+    std::erase_if(m_textures_by_binding, [=](const auto& tex) { return tex.second == (void*)handle; });
+    erase(m_textures, handle);
+  }
+
+  std::vector<std::unique_ptr<buffer>> m_buffers;
+  std::vector<std::unique_ptr<texture>> m_textures;
+  std::vector<std::unique_ptr<std::vector<char>>> m_readbacks;
+  std::vector<std::vector<char>*> m_free_readbacks;
+  std::vector<std::unique_ptr<query>> m_queries;
+  std::vector<query*> m_free_queries;
+  std::map<int, buffer*> m_ubos;
+  std::map<int, texture*> m_textures_by_binding;
+  staging_arena m_staging;
+  char m_sampler{};
+};
+}
@@ -0,0 +1,249 @@
+#pragma once
+#include "helpers.hpp"
+#include "input_tracking.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace gpu
+{
+// Worker threads for the gpu::cpu_task of the nodes
+class thread_pool
+{
+public:
+  explicit thread_pool(unsigned threads = default_thread_count())
+  {
+    for (unsigned i = 0; i < threads; i++)
+      m_threads.emplace_back([this](std::stop_token stop) { work(stop); });
+  }
+
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+
+  // Jobs not started yet are dropped: their futures get a broken_promise
+  ~thread_pool()
+  {
+    for (auto& t : m_threads)
+      t.request_stop();
+    m_condition.notify_all();
+    m_threads.clear();
+  }
+
+  std::future<void> submit(std::function<void()> job)
+  {
+    std::packaged_task<void()> task{std::move(job)};
+    auto future = task.get_future();
+    {
+      std::lock_guard lock{m_mutex};
+      m_jobs.push_back(std::move(task));
+    }
+    m_condition.notify_one();
+    return future;
+  }
+
+  std::size_t size() const noexcept { return m_threads.size(); }
+
+  // Leaves a core to the render thread
+  static unsigned default_thread_count() noexcept
+  {
+    const unsigned cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 1;
+  }
+
+private:
+  void work(std::stop_token stop)
+  {
+    for (;;)
+    {
+      std::packaged_task<void()> job;
+      {
+        std::unique_lock lock{m_mutex};
+        if (!m_condition.wait(lock, stop, [this] { return !m_jobs.empty(); }))
+          return;
+        job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+      }
+      job();
+    }
+  }
+
+  std::mutex m_mutex;
+  std::condition_variable_any m_condition;
+  std::deque<std::packaged_task<void()>> m_jobs;
+  std::vector<std::jthread> m_threads;
+};
+
+// Runs the coroutines of several nodes on the render thread, interleaved.
+// When a coroutine yields a cpu_task, the work goes to the thread pool and
+// the coroutine is set aside until it completes ; the commands of the other
+// coroutines keep being executed meanwhile.
+//
+//   gpu::interleaved_runner<gpu::update_action, gpu::update_handle> runner{pool};
+//   for (auto& node : nodes)
+//     runner.run_update(node);
+//   runner.finish(backend);
+template <typename Action, typename Feedback>
+class interleaved_runner
+{
+public:
+  using generator_type = gpu::generator<Action, Feedback>;
+
+  explicit interleaved_runner(thread_pool& pool)
+      : m_pool{pool}
+  {
+  }
+
+  interleaved_runner(const interleaved_runner&) = delete;
+  interleaved_runner& operator=(const interleaved_runner&) = delete;
+
+  // The work of the coroutines still in flight references their frames:
+  // it has to be over before they are destroyed
+  ~interleaved_runner()
+  {
+    for (auto& t : m_tasks)
+      if (t.work)
+        t.work->wait();
+  }
+
+  void run(generator_type coroutine)
+  {
+    m_tasks.push_back(task{std::move(coroutine), {}, {}});
+  }
+
+  // Runs a node's update(), if gpu::update_required() says it has to
+  template <typename Node>
+  void run_update(Node& node)
+  {
+    if (update_required(node))
+      run(node.update());
+  }
+
+  // Advances every coroutine which is not waiting for its CPU work as far
+  // as possible. Returns the number of coroutines still in flight.
+  template <typename Backend>
+  int poll(Backend& backend)
+  {
+    for (auto& t : m_tasks)
+    {
+      if (t.work && t.work->wait_for(std::chrono::seconds{0}) == std::future_status::ready)
+      {
+        // Rethrows what the work threw, in the host
+        std::exchange(t.work, std::nullopt)->get();
+        ++*t.iterator;
+      }
+      if (!t.work)
+        step(t, backend);
+    }
+
+    std::erase_if(m_tasks, [](const task& t) { return t.done(); });
+    return m_tasks.size();
+  }
+
+  // Polls until every coroutine is done. After a poll, the coroutines left
+  // all wait for their CPU work: there is nothing to do but wait for
+  // whichever completes first.
+  template <typename Backend>
+  void finish(Backend& backend)
+  {
+    auto& c = *m_completions;
+    for (;;)
+    {
+      std::uint64_t seen{};
+      {
+        std::lock_guard lock{c.mutex};
+        seen = c.count;
+      }
+      if (poll(backend) == 0)
+        return;
+
+      std::unique_lock lock{c.mutex};
+      c.condition.wait(lock, [&] { return c.count != seen; });
+    }
+  }
+
+private:
+  struct task
+  {
+    generator_type coroutine;
+    std::optional<typename generator_type::iterator> iterator;
+    std::optional<std::future<void>> work;
+
+    bool done() const noexcept
+    {
+      return iterator && *iterator == std::default_sentinel && !work;
+    }
+  };
+
+  // Counts the CPU work completed, after its future is ready.
+  // Shared with the jobs, which may still be unwinding when the runner goes.
+  struct completions
+  {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::uint64_t count{};
+  };
+
+  std::future<void> submit(cpu_task job)
+  {
+    auto done = std::make_shared<std::promise<void>>();
+    auto future = done->get_future();
+    m_pool.submit(
+        [job, done, c = m_completions]
+        {
+          try
+          {
+            job();
+            done->set_value();
+          }
+          catch (...)
+          {
+            done->set_exception(std::current_exception());
+          }
+          {
+            std::lock_guard lock{c->mutex};
+            c->count++;
+          }
+          c->condition.notify_all();
+        });
+    return future;
+  }
+
+  template <typename Backend>
+  void step(task& t, Backend& backend)
+  {
+    if (!t.iterator)
+      t.iterator.emplace(t.coroutine.begin());
+
+    while (*t.iterator != std::default_sentinel)
+    {
+      auto& promise = **t.iterator;
+      if (auto job = std::get_if<cpu_task>(&promise.current_command))
+      {
+        t.work = submit(*job);
+        return;
+      }
+
+      promise.feedback_value = gpu::execute<Feedback>(backend, promise.current_command);
+      ++*t.iterator;
+    }
+  }
+
+  thread_pool& m_pool;
+  std::shared_ptr<completions> m_completions{std::make_shared<completions>()};
+  std::vector<task> m_tasks;
+};
+
+using update_runner = interleaved_runner<update_action, update_handle>;
+using dispatch_runner = interleaved_runner<dispatch_action, dispatch_handle>;
+}
@@ -0,0 +1,275 @@
+#pragma once
+#include "helpers.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+// Flat tables describing a layout's bindings and attributes.
+// The reflection over the layout is done once, at compile time: backends
+// setting up pipelines or bindings every frame only loop over an array.
+//
+// The last entry of a layout with bindings is the default uniforms UBO, at
+// gpu::default_uniforms_binding<Layout>(). In gpu::descriptors, graphics
+// bindings are in both stages ; make_descriptors<Layout>(vertex, fragment)
+// restricts them to gpu::binding_stages, which the preamble writers use
+// to choose where to declare each binding.
+namespace gpu
+{
+enum class descriptor_kind : std::uint8_t
+{
+  input,
+  output,
+  sampler2D,
+  ubo,
+  storage_buffer,
+  image2D,
+  push_constant
+};
+
+enum stage_mask : std::uint8_t
+{
+  vertex_stage = 1 << 0,
+  fragment_stage = 1 << 1,
+  compute_stage = 1 << 2
+};
+
+enum access_mask : std::uint8_t
+{
+  read_access = 1 << 0,
+  write_access = 1 << 1
+};
+
+struct descriptor
+{
+  descriptor_kind kind{};
+  std::uint8_t stages{};
+  std::uint8_t access{};
+
+  // Vertex fetch format of attributes
+  attribute_component component{};
+  std::uint8_t components{};
+
+  // -1 for attributes and push constants
+  int binding{-1};
+
+  // -1 for bindings
+  int location{-1};
+
+  // std140 size of uniform and push constant blocks (0 for storage buffers
+  // with a runtime array), size of the data of attributes
+  int size{};
+
+  // For images
+  texture_format format{};
+
+  std::string_view name;
+};
+static_assert(std::is_trivially_copyable_v<descriptor>);
+
+namespace descriptors_detail
+{
+struct shader_sources
+{
+  std::string_view vertex;
+  std::string_view fragment;
+};
+
+// Calls f on every member of a default-constructed T, at compile time
+template <typename T, typename F>
+constexpr void for_each_member(F&& f)
+{
+  constexpr T t{};
+  reflect::for_each_member(t, f);
+}
+
+template <typename C>
+constexpr std::uint8_t access()
+{
+  constexpr bool load = requires { C::load; } || requires { C::readonly; };
+  constexpr bool store = requires { C::store; } || requires { C::writeonly; };
+  if constexpr (load && !store)
+    return read_access;
+  else if constexpr (store && !load)
+    return write_access;
+  else
+    return read_access | write_access;
+}
+
+template <typename C>
+constexpr bool has_runtime_array()
+{
+  bool runtime = false;
+  for_each_member<C>([&]<typename F>(const F&) {
+    runtime |= std::is_pointer_v<std::remove_cvref_t<decltype(F{}.value)>>;
+  });
+  return runtime;
+}
+
+template <typename C>
+constexpr descriptor make_binding(const C& field, std::uint8_t stages)
+{
+  descriptor d{.stages = stages, .binding = field.binding(), .name = field.name()};
+  if constexpr (requires { C::sampler2D; })
+  {
+    d.kind = descriptor_kind::sampler2D;
+    d.access = read_access;
+  }
+  else if constexpr (requires { C::ubo; })
+  {
+    d.kind = descriptor_kind::ubo;
+    d.access = read_access;
+    d.size = std140_size<C>();
+  }
+  else if constexpr (requires { C::buffer; })
+  {
+    d.kind = descriptor_kind::storage_buffer;
+    d.access = access<C>();
+    if constexpr (!has_runtime_array<C>())
+      d.size = std140_size<C>();
+  }
+  else if constexpr (requires { C::image2D; })
+  {
+    d.kind = descriptor_kind::image2D;
+    d.access = access<C>();
+    if constexpr (requires { field.format(); })
+      d.format = field.format();
+  }
+  return d;
+}
+
+// Samplers and images are used by name, blocks through their members
+template <typename C>
+constexpr bool uses(std::string_view source, const C& field)
+{
+  if constexpr (requires { C::sampler2D; } || requires { C::image2D; })
+    return references(source, field.name());
+  else
+    return references_block(source, field);
+}
+
+}
+
+// The stages of a graphics pipeline declaring a binding: those whose source
+// uses it. Push constants share one range across the pipeline, and a
+// binding no stage uses stays in both, so that a mask is never empty.
+template <typename C>
+constexpr std::uint8_t binding_stages(std::string_view vertex, std::string_view fragment, const C& field)
+{
+  constexpr std::uint8_t both = vertex_stage | fragment_stage;
+  if constexpr (requires { C::push_constant; })
+  {
+    return both;
+  }
+  else
+  {
+    const std::uint8_t stages = (descriptors_detail::uses(vertex, field) ? vertex_stage : 0)
+                                | (descriptors_detail::uses(fragment, field) ? fragment_stage : 0);
+    return stages ? stages : both;
+  }
+}
+
+namespace descriptors_detail
+{
+
+// Visits the attributes and bindings of a layout in a fixed order,
+// with the stages they are used in: all of them without the sources
+template <typename Layout, typename F>
+constexpr void visit(F&& f, const shader_sources* sources = nullptr)
+{
+  auto attributes = [&]<typename Block>(descriptor_kind kind, std::uint8_t stage)
+  {
+    for_each_member<Block>([&]<typename A>(const A& attr) {
+      // Built-ins such as gl_Position have no location
+      if constexpr (requires { attr.location(); })
+      {
+        f(descriptor{
+            .kind = kind,
+            .stages = stage,
+            .access = kind == descriptor_kind::input ? read_access : write_access,
+            .component = component_of<decltype(attr.data)>(),
+            .components = std::uint8_t(component_count<decltype(attr.data)>()),
+            .location = attr.location(),
+            .size = int(sizeof(attr.data)),
+            .name = attr.name()});
+      }
+    });
+  };
+
+  if constexpr (requires { Layout::vertex_input; })
+    attributes.template operator()<decltype(Layout::vertex_input)>(descriptor_kind::input, vertex_stage);
+  if constexpr (requires { Layout::vertex_output; })
+    attributes.template operator()<decltype(Layout::vertex_output)>(descriptor_kind::output, vertex_stage);
+  if constexpr (requires { Layout::fragment_input; })
+    attributes.template operator()<decltype(Layout::fragment_input)>(descriptor_kind::input, fragment_stage);
+  if constexpr (requires { Layout::fragment_output; })
+    attributes.template operator()<decltype(Layout::fragment_output)>(descriptor_kind::output, fragment_stage);
+
+  // Bindings, with the stages declaring them
+  if constexpr (requires { Layout::bindings; })
+  {
+    constexpr bool compute = requires { Layout::compute; };
+    constexpr std::uint8_t all_stages = compute ? compute_stage : (vertex_stage | fragment_stage);
+    auto stages = [&](const auto& field) -> std::uint8_t
+    {
+      return !compute && sources ? binding_stages(sources->vertex, sources->fragment, field)
+                                 : all_stages;
+    };
+
+    for_each_member<decltype(Layout::bindings)>(
+        [&]<typename C>(const C& field) {
+          if constexpr (requires { field.binding(); })
+            f(make_binding(field, stages(field)));
+          else if constexpr (requires { C::push_constant; })
+            f(descriptor{
+                .kind = descriptor_kind::push_constant,
+                .stages = stages(field),
+                .access = read_access,
+                .size = std140_size<C>(),
+                .name = field.name()});
+        });
+
+    constexpr default_uniforms_ubo defaults{};
+    f(descriptor{
+        .kind = descriptor_kind::ubo,
+        .stages = stages(defaults),
+        .access = read_access,
+        .binding = default_uniforms_binding<Layout>(),
+        .size = std140_size<default_uniforms_ubo>(),
+        .name = defaults.name()});
+  }
+}
+
+template <typename Layout>
+constexpr int count()
+{
+  int n = 0;
+  visit<Layout>([&](const descriptor&) { n++; });
+  return n;
+}
+}
+
+// All the attributes then all the bindings of a layout
+template <typename Layout>
+consteval auto make_descriptors()
+{
+  std::array<descriptor, descriptors_detail::count<Layout>()> table{};
+  int i = 0;
+  descriptors_detail::visit<Layout>([&](const descriptor& d) { table[i++] = d; });
+  return table;
+}
+
+// The same, for a graphics pipeline with the given shader sources
+template <typename Layout>
+constexpr auto make_descriptors(std::string_view vertex, std::string_view fragment)
+{
+  std::array<descriptor, descriptors_detail::count<Layout>()> table{};
+  int i = 0;
+  const descriptors_detail::shader_sources sources{vertex, fragment};
+  descriptors_detail::visit<Layout>([&](const descriptor& d) { table[i++] = d; }, &sources);
+  return table;
+}
+
+template <typename Layout>
+inline constexpr auto descriptors = make_descriptors<Layout>();
+}
@@ -1,10 +1,14 @@
 #pragma once
 #include "helpers.hpp"
+#include "tiling.hpp"
+#include "triple_buffer.hpp"
 #include <halp/static_string.hpp>
 #include <halp/controls.hpp>
-#include <avnd/common/member_reflection.hpp>
-#include <fmt/format.h>
-#include <fmt/printf.h>
+
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <vector>
 
 namespace examples
 {
@@ -16,49 +20,65 @@ struct GpuComputeExample
   halp_meta(name, "My GPU pipeline");
   halp_meta(uuid, "03bce361-a2ca-4959-95b4-6aac3b6c07b5");
 
-  static constexpr int downscale = 16;
+  // An analysis: when frames are over budget it is fine to only refresh
+  // it every few frames, see gpu::node_scheduler
+  halp_meta(update_priority, gpu::priority::low);
+  halp_meta(max_update_interval, 4);
+
+  // Pixels per side summed by each invocation, by default
+  static constexpr int default_downscale = 16;
+
+  // Tiled mode: pixels per side of a tile, a multiple of the pixels
+  // a workgroup covers
+  static constexpr int tile_size = 1024;
 
   // Define the layout of our pipeline in C++ simply through the structure of a struct
   struct layout
   {
-    halp_meta(local_size_x, 16)
-    halp_meta(local_size_y, 16)
-    halp_meta(local_size_z, 1)
     halp_flags(compute);
 
+    // Specialization constants: changing them does not recompile the shader
+    struct specialization
+    {
+      gpu::local_size_constant<'x', 0, 16> local_size_x;
+      gpu::local_size_constant<'y', 1, 16> local_size_y;
+      gpu::local_size_constant<'z', 2, 1> local_size_z;
+      gpu::specialization_constant<"downscale", int, 3, GpuComputeExample::default_downscale> downscale;
+    } specialization;
+
     struct bindings
     {
       // Each binding is a struct member
       struct {
         halp_meta(name, "my_buf");
         halp_meta(binding, 0);
-        halp_flags(std140, buffer, load, store);
+        halp_flags(std430, buffer, load, store);
 
         using color = float[4];
         gpu::uniform<"result", color*> values;
       } my_buf;
 
-      // Define the members of our ubos
-      struct custom_ubo {
-        halp_meta(name, "custom");
-        halp_meta(binding, 1);
-        halp_flags(std140, ubo);
+      // Small values set for each dispatch, without any buffer:
+      // push constants take no binding
+      struct extent_constants {
+        halp_meta(name, "extent");
+        halp_flags(push_constant);
 
         gpu::uniform<"width", int> width;
         gpu::uniform<"height", int> height;
-      } ubo;
+      } extent;
 
       struct  {
         halp_meta(name, "img")
-        halp_meta(format, "rgba32f")
-        halp_meta(binding, 2);
+        halp_meta(format, gpu::texture_format::rgba32f)
+        halp_meta(binding, 1);
         halp_flags(image2D, readonly);
       } image;
     } bindings;
   };
 
   using bindings = decltype(layout::bindings);
-  using uniforms = decltype(bindings::ubo);
+  using uniforms = decltype(bindings::extent);
 
   // Definition of our ports which will get parsed by the
   // software that instantiate this class
@@ -77,6 +97,11 @@ struct GpuComputeExample
       > height;
   } inputs;
 
+  // The controls bound to the push constants, published by the thread
+  // writing them through controls.publish(inputs). update() and dispatch()
+  // only read this snapshot, so that the sizes always match the push constants.
+  gpu::uniform_snapshot<decltype(inputs), uniforms> controls;
+
   // The output port on which we write the average color
   struct {
     struct {
@@ -85,6 +110,16 @@ struct GpuComputeExample
     } color_out;
   } outputs;
 
+  // Host-side image, e.g. a memory-mapped gigapixel file. When set, it is
+  // streamed through the GPU tile by tile instead of being read from the
+  // "Image" port, with two tiles in flight whatever its size.
+  gpu::image_view source{};
+
+  // Pixels per side summed by each invocation. The shader gets it as a
+  // specialization constant: changing it re-specializes the pipeline,
+  // and reallocates the buffers on the next update().
+  int downscale{default_downscale};
+
   std::string_view compute()
   {
     return R"_(
@@ -96,12 +131,12 @@ void main()
   ivec2 call = ivec2(gl_GlobalInvocationID.xy);
   vec4 color = vec4(0,0,0,0);
 
-  for(int i = 0; i < gl_WorkGroupSize.x; i++)
+  for(int i = 0; i < downscale; i++)
   {
-    for(int j = 0; j < gl_WorkGroupSize.y; j++)
+    for(int j = 0; j < downscale; j++)
     {
-      uint x = call.x * gl_WorkGroupSize.x + i;
-      uint y = call.y * gl_WorkGroupSize.y + j;
+      uint x = call.x * downscale + i;
+      uint y = call.y * downscale + j;
 
       if (x < width && y < height)
       {
@@ -110,9 +145,12 @@ void main()
     }
   }
 
-  if(gl_LocalInvocationIndex < ((width * height) / gl_WorkGroupSize.x * gl_WorkGroupSize.y))
+  // One value per invocation, in rows as wide as the dispatch: past the
+  // right edge they are zeros, past the bottom one nothing is written
+  if(call.y < (height + downscale - 1) / downscale)
   {
-    result[gl_GlobalInvocationID.y * gl_WorkGroupSize.x + gl_GlobalInvocationID.x] = color;
+    uint stride = gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+    result[gl_GlobalInvocationID.y * stride + gl_GlobalInvocationID.x] = color;
   }
 }
 )_";
@@ -121,23 +159,63 @@ void main()
   // Allocate and update buffers
   gpu::co_update update()
   {
+    // The result buffers hold one value per downscale^2 pixels
+    if(current_downscale != downscale)
+    {
+      for(auto& slot : this->tiles)
+      {
+        if(slot.result) {
+          co_yield gpu::buffer_release{.handle = slot.result};
+          slot.result = nullptr;
+        }
+      }
+      if(this->buf) {
+        co_yield gpu::buffer_release{.handle = buf};
+        buf = nullptr;
+      }
+      current_downscale = downscale;
+    }
+
+    if(this->source.data)
+    {
+      for(auto& slot : this->tiles)
+      {
+        if(!slot.texture)
+        {
+          slot.texture = co_yield gpu::texture_allocation{
+              .binding = lay.bindings.image.binding()
+            , .width = tile_size
+            , .height = tile_size
+            , .format = gpu::texture_format::rgba32f
+          };
+        }
+        if(!slot.result)
+        {
+          slot.result = co_yield gpu::static_allocation{
+              .binding = lay.bindings.my_buf.binding()
+            , .size = tile_result_bytes()
+          };
+        }
+      }
+      co_return;
+    }
+
     // Deallocate if the size changed
-    const int w = this->inputs.width / downscale;
-    const int h = this->inputs.height / downscale;
-    if(last_w != w || last_h != h)
+    const auto& in = controls.inputs();
+    const int count = result_cells(in.width, in.height);
+    if(last_count != count)
     {
       if(this->buf) {
         co_yield gpu::buffer_release{.handle = buf};
         buf = nullptr;
       }
-      last_w = w;
-      last_h = h;
+      last_count = count;
     }
 
-    if(w > 0 && h > 0)
+    if(count > 0)
     {
       // No buffer: reallocate
-      const int bytes = w * h * sizeof(float) * 4;
+      const int bytes = count * sizeof(float) * 4;
       if(!this->buf)
       {
         this->buf = co_yield gpu::static_allocation{
@@ -155,59 +233,169 @@ void main()
       co_yield gpu::buffer_release{.handle = buf};
       buf = nullptr;
     }
+    for(auto& slot : tiles)
+    {
+      if(slot.texture) {
+        co_yield gpu::texture_release{.handle = slot.texture};
+        slot.texture = nullptr;
+      }
+      if(slot.result) {
+        co_yield gpu::buffer_release{.handle = slot.result};
+        slot.result = nullptr;
+      }
+    }
   }
 
   // Do the GPU dispatch call
   gpu::co_dispatch dispatch()
+  {
+    return source.data ? dispatch_tiles() : dispatch_image();
+  }
+
+private:
+  gpu::co_dispatch dispatch_image()
   {
     if(!buf)
       co_return;
 
-    const int w = this->inputs.width / downscale;
-    const int h = this->inputs.height / downscale;
-    const int bytes = w * h * sizeof(float) * 4;
+    const auto& in = controls.inputs();
+    const int width = in.width;
+    const int height = in.height;
+
+    if(auto spec = respecialize())
+      co_yield *spec;
 
     // Run a pass
     co_yield gpu::begin_compute_pass{};
 
-    co_yield gpu::compute_dispatch{.x = 1, .y = 1, .z = 1};
+    for(auto& push : controls.push_constants())
+      co_yield push;
 
-    // Request an asynchronous readback
-    gpu::buffer_awaiter readback = co_yield gpu::readback_buffer{
-        .handle = buf
-      , .offset = 0
-      , .size = bytes
-    };
+    co_yield gpu::compute_dispatch{.x = groups(width), .y = groups(height), .z = 1};
 
     co_yield gpu::end_compute_pass{};
 
-    // The readback can be fetched once the compute pass is done
+    // Finish summing on the GPU: only the final value gets read back
+    gpu::buffer_awaiter readback = co_yield gpu::reduce_buffer{
+        .handle = buf
+      , .count = result_cells(width, height)
+    };
+
+    // The readback can be fetched once the reduction passes are done
     // (this needs to be improved in terms of asyncness)
     auto [data, size] = co_yield readback;
 
-    using color = float[4];
-    auto flt = reinterpret_cast<const color*>(data);
-
-    // finish summing on the cpu
+    auto flt = reinterpret_cast<const float*>(data);
     auto& final = outputs.color_out.value;
-    std::ranges::fill(final, 0.f);
+    std::copy_n(flt, 4, final);
 
-    for(int i = 0; i < w * h; i++) {
-      for(int j = 0; j < 4; j++)
-        final[j] += flt[i][j];
-    }
-
-    double pixels_total = this->inputs.width * this->inputs.height;
+    double pixels_total = double(width) * height;
     final[0] /= pixels_total;
     final[1] /= pixels_total;
     final[2] /= pixels_total;
     final[3] /= pixels_total;
   }
 
-private:
+  // The value of the downscale constant the pipeline was specialized
+  // with, if it has to change
+  std::optional<gpu::specialize> respecialize()
+  {
+    if(specialized_downscale == current_downscale)
+      return std::nullopt;
+    specialized_downscale = current_downscale;
+    return gpu::specialize{
+        .constant_id = lay.specialization.downscale.constant_id()
+      , .size = sizeof(specialized_downscale)
+      , .data = &specialized_downscale
+    };
+  }
+
+  // Invocations per side, each summing downscale^2 pixels, and workgroups
+  // per side. The shader writes rows of groups(width) * local size values
+  // for the first cells(height) rows: those are what gets reduced.
+  static constexpr int local_size = layout{}.specialization.local_size_x.value;
+  static_assert(local_size == layout{}.specialization.local_size_y.value);
+
+  int cells(int pixels) const { return (pixels + current_downscale - 1) / current_downscale; }
+  int groups(int pixels) const { return (cells(pixels) + local_size - 1) / local_size; }
+  int result_cells(int width, int height) const { return groups(width) * local_size * cells(height); }
+  int tile_result_bytes() const { return result_cells(tile_size, tile_size) * sizeof(float) * 4; }
+
+  // While tile i is summed from one slot, tile i + 1 is uploaded to the
+  // other ; each slot's partial sum is merged right before the slot is
+  // used again, so the device is never waited for until the last tiles.
+  gpu::co_dispatch dispatch_tiles()
+  {
+    const gpu::tile_grid grid{source.width, source.height, tile_size};
+    if(grid.size() == 0 || !tiles[0].texture)
+      co_return;
+
+    if(auto spec = respecialize())
+      co_yield *spec;
+
+    double sum[4]{};
+    auto merge = [&](gpu::buffer_view partial) {
+      auto flt = reinterpret_cast<const float*>(partial.data);
+      for(int c = 0; c < 4; c++)
+        sum[c] += flt[c];
+    };
+
+    co_yield gpu::upload_tile(source, grid[0], tiles[0].texture);
+    for(int i = 0; i < grid.size(); i++)
+    {
+      auto& slot = tiles[i % 2];
+      if(i + 1 < grid.size())
+        co_yield gpu::upload_tile(source, grid[i + 1], tiles[(i + 1) % 2].texture);
+
+      if(slot.pending)
+        merge(co_yield *std::exchange(slot.pending, std::nullopt));
+
+      const gpu::tile t = grid[i];
+      co_yield gpu::begin_compute_pass{};
+      co_yield gpu::bind_texture{.binding = lay.bindings.image.binding(), .handle = slot.texture};
+      co_yield gpu::bind_buffer{
+          .binding = lay.bindings.my_buf.binding()
+        , .handle = slot.result
+        , .offset = 0
+        , .size = tile_result_bytes()
+      };
+      const int extent[2]{t.width, t.height};
+      co_yield gpu::set_push_constants{.offset = 0, .size = sizeof(extent), .data = (void*)extent};
+      co_yield gpu::compute_dispatch{.x = groups(t.width), .y = groups(t.height), .z = 1};
+      co_yield gpu::end_compute_pass{};
+
+      slot.pending = co_yield gpu::reduce_buffer{
+          .handle = slot.result
+        , .count = result_cells(t.width, t.height)
+      };
+    }
+
+    // Oldest first
+    for(int i = grid.size(); i < grid.size() + 2; i++)
+    {
+      auto& slot = tiles[i % 2];
+      if(slot.pending)
+        merge(co_yield *std::exchange(slot.pending, std::nullopt));
+    }
+
+    const double pixels_total = double(source.width) * source.height;
+    for(int c = 0; c < 4; c++)
+      outputs.color_out.value[c] = sum[c] / pixels_total;
+  }
+
+  struct tile_slot
+  {
+    gpu::texture_handle texture{};
+    gpu::buffer_handle result{};
+    std::optional<gpu::buffer_awaiter> pending{};
+  };
+
   static constexpr auto lay = layout{};
-  int last_w{}, last_h{};
+  int last_count{};
+  int current_downscale{default_downscale};
+  int specialized_downscale{default_downscale};
   gpu::buffer_handle buf{};
+  std::array<tile_slot, 2> tiles{};
   std::vector<float> zeros{};
 };
 
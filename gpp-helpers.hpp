@@ -1,8 +1,10 @@
 #pragma once
 #include "helpers.hpp"
+#include "input_tracking.hpp"
+#include "triple_buffer.hpp"
+#include <random>
 #include <halp/static_string.hpp>
 #include <halp/controls.hpp>
-#include <avnd/common/member_reflection.hpp>
 
 namespace examples
 {
@@ -66,6 +68,13 @@ struct GpuFilterExample
 
   } inputs;
 
+  // Only run update() when one of the inputs above changed
+  gpu::input_tracker<decltype(inputs)> input_changes;
+
+  // The UBO-bound controls, published by the thread writing them
+  // through controls.publish(inputs)
+  gpu::uniform_snapshot<decltype(inputs), uniforms> controls;
+
   struct {
     gpu::color_attachment_port<"Main out", &layout::fragment_output::col> fragColor;
   } outputs;
@@ -92,6 +101,7 @@ void main()
   }
 
   std::vector<uint8_t> tex;
+  std::minstd_rand rng;
 
   gpu::texture_handle tex_handle{};
 
@@ -104,41 +114,64 @@ void main()
       .binding = lay.bindings.ubo.binding()
     };
 
-    // Upload some data into it, using an input (non-uniform) of our node
-    using namespace std;
-    float xy[2] = {cos(inputs.other), sin(inputs.other)};
+    // Copy the latest snapshot of the controls bound to it
+    for(auto& upload : controls.uploads(ubo))
+      co_yield upload;
 
-    co_yield gpu::dynamic_ubo_upload{
-        .handle = ubo,
-        .offset = 0,
-        .size = sizeof(xy),
-        .data = &xy
-    };
+    // Upload some data into it, using an input (non-uniform) of our node,
+    // as published along with the controls
+    const auto& in = controls.inputs();
+    if(input_changes.changed(in.other))
+    {
+      using namespace std;
+      float xy[2] = {cos(in.other), sin(in.other)};
+
+      co_yield gpu::dynamic_ubo_upload{
+          .handle = ubo,
+          .offset = 0,
+          .size = sizeof(xy),
+          .data = &xy
+      };
+    }
 
     // The sampler is not used by the inputs block, so we have to allocate it ourselves
-    int sz = 16*16*4;
+    constexpr auto format = gpu::texture_format::rgba8;
+    constexpr int sz = gpu::texture_bytes(format, 16, 16);
     if(!tex_handle)
     {
       this->tex_handle = co_yield gpu::texture_allocation{
           .binding = lay.bindings.texture_input.binding()
         , .width = 16
         , .height = 16
+        , .format = format
+        , .mip_levels = 0
       };
-    }
 
-    // And upload some data
-    tex.resize(sz);
-    for(int i = 0; i < sz; i++)
-      tex[i] = rand();
+      // And upload some data, generated on a worker thread
+      tex.resize(sz);
+      co_yield gpu::cpu_task{[&] {
+        for(auto& texel : tex)
+          texel = rng();
+      }};
+
+      co_yield gpu::texture_upload{
+          .handle = tex_handle
+        , .offset = 0
+        , .size = sz
+        , .data = tex.data()
+      };
 
-    co_yield gpu::texture_upload{
-        .handle = tex_handle
-      , .offset = 0
-      , .size = sz
-      , .data = tex.data()
-    };
+      // The texture is minified when drawn: sample it from its mip chain
+      co_yield gpu::generate_mips{.handle = tex_handle};
+
+      // It can be generated again: let the host reclaim it when memory is short
+      co_yield gpu::set_residency{.texture = &tex_handle};
+    }
   }
 
+  // The texture has been evicted: generate it again, even if no input changed
+  bool needs_update() const { return !tex_handle; }
+
 
   gpu::co_release release()
   {
@@ -1,7 +1,27 @@
 #include "gpp.hpp"
+#include "gpp-compute.hpp"
+#include "capture.hpp"
+#include "command_queue.hpp"
+#include "cpu_tasks.hpp"
+#include "descriptors.hpp"
+#include "input_tracking.hpp"
+#include "mesh_optimizer.hpp"
+#include "reduction.hpp"
+#include "scheduler.hpp"
+#include "specialization.hpp"
+#include "staging.hpp"
+#include "timings.hpp"
+#include "upload_batcher.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <map>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <boost/pfr/core.hpp>
 #include <fmt/format.h>
 
 // the parsing code here does not depend on the actual implementation 
@@ -9,84 +29,425 @@
 
 struct handle_command
 {
+  // Handles are opaque to the nodes: the mock simply hands out numbered ints
+  int next_handle = 1;
+  std::map<int, gpu::buffer_handle> ubos;
+  std::map<int, std::vector<char>> readbacks;
+  std::map<int, gpu::reduction> reductions;
+
+  // Timed on the CPU, as the commands are "executed" when they are received
+  struct query
+  {
+    std::chrono::steady_clock::time_point start;
+    std::chrono::nanoseconds elapsed;
+    bool ended{};
+  };
+  std::map<int, query> queries;
+
+  // The mock only ever has a single pipeline
+  gpu::specialization_state specialization;
+  gpu::pipeline_cache<int> pipelines;
+
+  gpu::staging_arena staging;
+  void end_frame() { staging.reset(); }
+  bool owns_staging(const void* ptr) const noexcept { return staging.owns(ptr); }
+
+  template <typename H>
+  H make_handle()
+  {
+    return reinterpret_cast<H>(new int{next_handle++});
+  }
+
+  static int id(const void* handle) { return handle ? *(const int*)handle : 0; }
+
   // If the command type is only variant<buffer_allocation, buffer_upload> then 
   // the other "cases" won't even be generated
   template <typename C>
-  void* operator()(C& command)
+  typename C::return_type operator()(const C& command)
   {
-    if constexpr (requires { C::static_buffer_allocation; })
+    if constexpr (requires { C::allocation; C::immutable; })
     {
-      std::cerr << "static buffer allocation requested\n";
+      std::cerr << "immutable buffer allocation requested\n";
       std::cerr << "  -> binding: " << command.binding << " ; sz: " << command.size << "\n";
-      return new int{1};
+      return make_handle<gpu::buffer_handle>();
     }
-    else if constexpr (requires { C::dynamic_buffer_allocation; })
+    else if constexpr (requires { C::allocation; C::static_; })
     {
-      std::cerr << "dynamic buffer allocation requested\n";
+      std::cerr << "static buffer allocation requested\n";
       std::cerr << "  -> binding: " << command.binding << " ; sz: " << command.size << "\n";
-      return new int{2};
+      return make_handle<gpu::buffer_handle>();
     }
-    else if constexpr (requires { C::immutable_buffer_allocation; })
+    else if constexpr (requires { C::allocation; C::dynamic; })
     {
-      std::cerr << "immutable buffer allocation requested\n";
+      std::cerr << "dynamic buffer allocation requested\n";
       std::cerr << "  -> binding: " << command.binding << " ; sz: " << command.size << "\n";
-      return new int{3};
+      auto handle = make_handle<gpu::buffer_handle>();
+      if constexpr (requires { C::ubo; })
+        ubos[command.binding] = handle;
+      return handle;
     }
-    else if constexpr (requires { C::texture_allocation; })
+    else if constexpr (requires { C::allocation; C::texture; })
     {
       std::cerr << "texture allocation requested\n";
-      return new int{4};
+      std::cerr << "  -> binding: " << command.binding << " ; size: " << command.width << "x" << command.height << "\n";
+      std::cerr << "  -> format: " << gpu::format_name(command.format) << " ; mips: " << command.mip_levels << "\n";
+      return make_handle<gpu::texture_handle>();
+    }
+    else if constexpr (requires { C::allocation; C::sampler; })
+    {
+      std::cerr << "sampler allocation requested\n";
+      return make_handle<gpu::sampler_handle>();
     }
-    else if constexpr (requires { C::static_buffer_upload; })
+    else if constexpr (requires { C::allocation; C::staging; })
+    {
+      std::cerr << "staging allocation requested\n";
+      std::cerr << "  -> sz: " << command.size << " ; align: " << command.align << "\n";
+      return staging.allocate(command.size, command.align);
+    }
+    else if constexpr (requires { C::upload; C::static_; })
     {
       std::cerr << "static buffer upload requested\n";
-      std::cerr << "  -> handle: " << *(int*) command.handle << "\n";
+      std::cerr << "  -> handle: " << id(command.handle) << "\n";
       std::cerr << "  -> offset: " << command.offset << " ; sz: " << command.size << "\n";
-      return nullptr;
     }
-    else if constexpr (requires { C::dynamic_buffer_upload; })
+    else if constexpr (requires { C::upload; C::dynamic; })
     {
       std::cerr << "dynamic buffer upload requested\n";
-      std::cerr << "  -> handle: " << *(int*) command.handle << "\n";
+      std::cerr << "  -> handle: " << id(command.handle) << "\n";
       std::cerr << "  -> offset: " << command.offset << " ; sz: " << command.size << "\n";
-      return nullptr;
     }
-    else if constexpr (requires { C::immutable_buffer_upload; })
+    else if constexpr (requires { C::upload; C::texture; })
+    {
+      std::cerr << "texture upload requested\n";
+      std::cerr << "  -> handle: " << id(command.handle) << "\n";
+      std::cerr << "  -> sz: " << command.size << "\n";
+      if (command.data_format)
+        std::cerr << "  -> converted from: " << int(*command.data_format) << "\n";
+      if (command.premultiply)
+        std::cerr << "  -> premultiplied\n";
+      if (command.width > 0 && command.height > 0)
+      {
+        std::cerr << "  -> region: " << command.x << ", " << command.y << " ; "
+                  << command.width << "x" << command.height << "\n";
+        std::cerr << "  -> mip: " << command.mip_level << " ; layer: " << command.array_layer
+                  << " ; row pitch: " << command.row_pitch << "\n";
+      }
+    }
+    else if constexpr (requires { C::mipmaps; C::texture; })
+    {
+      std::cerr << "mipmap generation requested\n";
+      std::cerr << "  -> handle: " << id(command.handle) << "\n";
+    }
+    else if constexpr (requires { C::getter; C::ubo; })
     {
-      std::cerr << "immutable buffer upload requested\n";
-      std::cerr << "  -> handle: " << *(int*) command.handle << "\n";
+      // The environment allocates the UBOs of the layout itself
+      std::cerr << "ubo handle requested\n";
+      std::cerr << "  -> binding: " << command.binding << "\n";
+      auto& handle = ubos[command.binding];
+      if (!handle)
+        handle = make_handle<gpu::buffer_handle>();
+      return handle;
+    }
+    else if constexpr (requires { C::getter; C::texture; })
+    {
+      std::cerr << "texture handle requested\n";
+      std::cerr << "  -> binding: " << command.binding << "\n";
+      return make_handle<gpu::texture_handle>();
+    }
+    else if constexpr (requires { C::deallocation; })
+    {
+      std::cerr << "release requested\n";
+      std::cerr << "  -> handle: " << id(command.handle) << "\n";
+      delete (int*)command.handle;
+    }
+    else if constexpr (requires { C::compute; C::bind; C::buffer; })
+    {
+      std::cerr << "buffer bind requested\n";
+      std::cerr << "  -> binding: " << command.binding << " ; handle: " << id(command.handle) << "\n";
       std::cerr << "  -> offset: " << command.offset << " ; sz: " << command.size << "\n";
-      return nullptr;
     }
-    else if constexpr (requires { C::texture_upload; })
+    else if constexpr (requires { C::compute; C::bind; C::texture; })
     {
-      std::cerr << "texture upload requested\n";
-      std::cerr << "  -> handle: " << *(int*) command.handle << "\n";
+      std::cerr << "texture bind requested\n";
+      std::cerr << "  -> binding: " << command.binding << " ; handle: " << id(command.handle) << "\n";
+    }
+    else if constexpr (requires { C::compute; C::reduce; C::buffer; })
+    {
+      // Run the built-in reduction passes like any other compute node
+      std::cerr << "buffer reduction requested\n";
+      std::cerr << "  -> handle: " << id(command.handle) << " ; count: " << command.count << "\n";
+      auto& reduction = reductions[id(command.handle)];
+      reduction.source = command.handle;
+      reduction.count = command.count;
+      for (auto& promise : reduction.update())
+        promise.feedback_value = gpu::execute<gpu::update_handle>(*this, promise.current_command);
+      for (auto& promise : reduction.dispatch())
+        promise.feedback_value = gpu::execute<gpu::dispatch_handle>(*this, promise.current_command);
+      return reduction.result;
+    }
+    else if constexpr (requires { C::push_constants; })
+    {
+      std::cerr << "push constants set\n";
+      std::cerr << "  -> offset: " << command.offset << " ; sz: " << command.size << "\n";
+    }
+    else if constexpr (requires { C::pipeline; C::specialization; })
+    {
+      if (specialization.set(command.constant_id, command.data, command.size))
+      {
+        std::cerr << "specialization constant changed\n";
+        std::cerr << "  -> constant_id: " << command.constant_id << "\n";
+      }
+    }
+    else if constexpr (requires { C::compute; C::begin; })
+    {
+      std::cerr << "compute pass begin\n";
+      pipelines.get(specialization.key(), [&] {
+        std::cerr << "  -> specializing pipeline " << pipelines.size() << "\n";
+        return int(pipelines.size());
+      });
+    }
+    else if constexpr (requires { C::compute; C::end; })
+    {
+      std::cerr << "compute pass end\n";
+    }
+    else if constexpr (requires { C::compute; C::dispatch; C::indirect; })
+    {
+      std::cerr << "indirect compute dispatch requested\n";
+      std::cerr << "  -> handle: " << id(command.handle) << " ; offset: " << command.offset << "\n";
+    }
+    else if constexpr (requires { C::compute; C::dispatch; })
+    {
+      std::cerr << "compute dispatch requested\n";
+      std::cerr << "  -> groups: " << command.x << ", " << command.y << ", " << command.z << "\n";
+    }
+    else if constexpr (requires { C::copy; C::buffer_to_buffer; })
+    {
+      std::cerr << "buffer copy requested\n";
+      std::cerr << "  -> src: " << id(command.src) << " ; offset: " << command.src_offset << "\n";
+      std::cerr << "  -> dst: " << id(command.dst) << " ; offset: " << command.dst_offset << "\n";
       std::cerr << "  -> sz: " << command.size << "\n";
-      return nullptr;
+    }
+    else if constexpr (requires { C::copy; C::texture_to_buffer; })
+    {
+      std::cerr << "texture to buffer copy requested\n";
+      std::cerr << "  -> src: " << id(command.src) << "\n";
+      std::cerr << "  -> dst: " << id(command.dst) << " ; offset: " << command.dst_offset << "\n";
+      std::cerr << "  -> sz: " << command.size << "\n";
+    }
+    else if constexpr (requires { C::copy; C::buffer_to_texture; })
+    {
+      std::cerr << "buffer to texture copy requested\n";
+      std::cerr << "  -> src: " << id(command.src) << " ; offset: " << command.src_offset << "\n";
+      std::cerr << "  -> dst: " << id(command.dst) << "\n";
+      std::cerr << "  -> sz: " << command.size << "\n";
+    }
+    else if constexpr (requires { C::readback; C::request; C::buffer; })
+    {
+      std::cerr << "buffer readback requested\n";
+      std::cerr << "  -> handle: " << id(command.handle) << "\n";
+      std::cerr << "  -> offset: " << command.offset << " ; sz: " << command.size << "\n";
+      const int readback = next_handle++;
+      readbacks[readback].resize(command.size);
+      return {.handle = reinterpret_cast<gpu::buffer_readback_handle>(readback)};
+    }
+    else if constexpr (requires { C::readback; C::await; C::buffer; })
+    {
+      auto& data = readbacks[(int)reinterpret_cast<intptr_t>(command.handle)];
+      return {.data = data.data(), .size = data.size()};
+    }
+    else if constexpr (requires { C::readback; C::request; C::texture; })
+    {
+      std::cerr << "texture readback requested\n";
+      std::cerr << "  -> handle: " << id(command.handle) << "\n";
+      if (command.width > 0 && command.height > 0)
+      {
+        std::cerr << "  -> region: " << command.x << ", " << command.y << " ; "
+                  << command.width << "x" << command.height << "\n";
+        std::cerr << "  -> mip: " << command.mip_level << " ; layer: " << command.array_layer << "\n";
+      }
+      const int readback = next_handle++;
+      readbacks[readback];
+      return {.handle = reinterpret_cast<gpu::texture_readback_handle>(readback)};
+    }
+    else if constexpr (requires { C::readback; C::await; C::texture; })
+    {
+      auto& data = readbacks[(int)reinterpret_cast<intptr_t>(command.handle)];
+      return {.data = data.data(), .size = data.size()};
+    }
+    else if constexpr (requires { C::query; C::timestamp; })
+    {
+      std::cerr << "timestamp written\n";
+      const int handle = next_handle++;
+      const auto now = std::chrono::steady_clock::now();
+      queries[handle] = {now, now.time_since_epoch(), true};
+      return reinterpret_cast<gpu::query_handle>(handle);
+    }
+    else if constexpr (requires { C::query; C::begin; })
+    {
+      std::cerr << "query begin\n";
+      const int handle = next_handle++;
+      queries[handle] = {std::chrono::steady_clock::now(), {}};
+      return reinterpret_cast<gpu::query_handle>(handle);
+    }
+    else if constexpr (requires { C::query; C::end; })
+    {
+      std::cerr << "query end\n";
+      auto it = queries.find((int)reinterpret_cast<intptr_t>(command.handle));
+      if (it == queries.end())
+      {
+        std::cerr << "  -> unknown query\n";
+        return;
+      }
+      it->second.elapsed = std::chrono::steady_clock::now() - it->second.start;
+      it->second.ended = true;
+    }
+    else if constexpr (requires { C::query; C::await; })
+    {
+      auto it = queries.find((int)reinterpret_cast<intptr_t>(command.handle));
+      if (it == queries.end())
+      {
+        std::cerr << "unknown query awaited\n";
+        return gpu::query_result{.ready = false, .nanoseconds = 0};
+      }
+      if (!it->second.ended)
+        return gpu::query_result{.ready = false, .nanoseconds = 0};
+      const gpu::query_result result{.ready = true, .nanoseconds = std::uint64_t(it->second.elapsed.count())};
+      queries.erase(it);
+      return result;
+    }
+    else
+    {
+      static_assert(std::is_void_v<typename C::return_type>, "unhandled command");
     }
   }
 };
 
-template <typename T>
-void handle_update(T& object)
+template <typename T, typename Backend>
+void handle_update(T& object, Backend& backend)
 {
+  // Nodes tracking their inputs cost nothing while idle
+  if (!gpu::update_required(object))
+    return;
+
   for (auto& promise : object.update())
   {
     promise.feedback_value
-        = std::visit(handle_command{}, promise.current_command);
+        = gpu::execute<gpu::update_handle>(backend, promise.current_command);
   }
 }
 
+template <typename T, typename Backend>
+void handle_dispatch(T& object, Backend& backend)
+{
+  for (auto& promise : object.dispatch())
+  {
+    promise.feedback_value
+        = gpu::execute<gpu::dispatch_handle>(backend, promise.current_command);
+  }
+}
+
+// What the host knows about the frame being rendered, besides the time
+struct frame_info
+{
+  float render_size[2]{};
+
+  // xy: current position, zw: position of the last click, in pixels
+  float mouse[4]{};
+
+  // Of the enclosing interval, in [0, 1]
+  float progress{};
+  float sample_rate{};
+
+  // Devices whose clip space or texture origin differ from OpenGL's
+  // set these, e.g. to flip Y
+  float clip_space_matrix[16]{1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+  float texcoord_adjust[2]{1, 0};
+};
+
+// Host-side state shared by all the nodes
+struct frame_context
+{
+  gpu::default_uniforms_ubo uniforms{};
+  gpu::buffer_handle ubo{};
+
+  // The default uniforms are uploaded once per frame, whatever the number
+  // of nodes referencing them.
+  template <typename Backend>
+  void begin_frame(Backend& backend, float time_delta, const frame_info& info = {})
+  {
+    constexpr int ubo_size = gpu::std140_size<gpu::default_uniforms_ubo>();
+    if (!ubo)
+    {
+      // Not tied to a given node: each pipeline binds it at
+      // gpu::default_uniforms_binding<layout>()
+      ubo = backend(gpu::dynamic_ubo_allocation{.binding = -1, .size = ubo_size});
+    }
+
+    uniforms.time_delta.value = time_delta;
+    uniforms.time.value += time_delta;
+
+    // Nodes are single-pass, and their inputs are in sync with the frame
+    uniforms.pass_index.value = 0;
+    std::fill_n(uniforms.channel_time.value, 4, uniforms.time.value);
+
+    std::copy_n(info.render_size, 2, uniforms.render_size.value);
+    std::copy_n(info.mouse, 4, uniforms.mouse.value);
+    std::copy_n(info.clip_space_matrix, 16, uniforms.clip_space_matrix.value);
+    std::copy_n(info.texcoord_adjust, 2, uniforms.texcoord_adjust.value);
+    uniforms.progress.value = info.progress;
+    uniforms.sample_rate.value = info.sample_rate;
+    write_date(uniforms.date.value);
 
+    gpu::dynamic_ubo_upload upload{
+        .handle = ubo, .offset = 0, .size = ubo_size, .data = &uniforms};
+    backend(upload);
+  }
+
+  // The frame has been submitted: per-frame memory can be recycled
+  template <typename Backend>
+  void end_frame(Backend& backend)
+  {
+    if constexpr (requires { backend.end_frame(); })
+      backend.end_frame();
+    uniforms.frame_index.value++;
+  }
+
+private:
+  // Year, month (0-11), day (1-31), seconds since midnight, in UTC
+  static void write_date(float (&date)[4])
+  {
+    using namespace std::chrono;
+    const auto now = system_clock::now();
+    const auto today = floor<days>(now);
+    const year_month_day ymd{today};
+    date[0] = int(ymd.year());
+    date[1] = unsigned(ymd.month()) - 1;
+    date[2] = unsigned(ymd.day());
+    date[3] = duration<float>(now - today).count();
+  }
+};
+
+
+static constexpr std::string_view field_type(bool) { return "bool"; }
 static constexpr std::string_view field_type(float) { return "float"; }
 static constexpr std::string_view field_type(const float (&)[2]) { return "vec2"; }
 static constexpr std::string_view field_type(const float (&)[3]) { return "vec3"; }
 static constexpr std::string_view field_type(const float (&)[4]) { return "vec4"; }
+static constexpr std::string_view field_type(const float (&)[16]) { return "mat4"; }
 static constexpr std::string_view field_type(int) { return "int"; }
 static constexpr std::string_view field_type(const int (&)[2]) { return "ivec2"; }
 static constexpr std::string_view field_type(const int (&)[3]) { return "ivec3"; }
 static constexpr std::string_view field_type(const int (&)[4]) { return "ivec4"; }
+
+// Quantized attributes are converted to floats by the vertex fetch
+template<typename T, std::size_t N>
+  requires (gpu::component_of<T>() != gpu::attribute_component::float32
+            && gpu::component_of<T>() != gpu::attribute_component::int32)
+static constexpr std::string_view field_type(const T (&)[N])
+{
+  constexpr std::string_view vectors[] = {"float", "vec2", "vec3", "vec4"};
+  return vectors[N - 1];
+}
 struct write_input
 {
   std::string& shader;
@@ -130,20 +491,55 @@ struct write_binding
   template<typename T>
   void operator()(const T& field) 
   {
+    using value_type = std::remove_cvref_t<decltype(field.value)>;
+    if constexpr (std::is_pointer_v<value_type>)
+    {
+      // Runtime-sized array, e.g. color*: only valid as the last member of a buffer
+      const std::remove_pointer_t<value_type> element{};
+      shader += fmt::format(
+          "  {} {}[];\n"
+          , field_type(element)
+          , field.name());
+    }
+    else
+    {
       shader += fmt::format(
           "  {} {};\n"
           , field_type(field.value)
           , field.name());
+    }
   }
 };
 
+// readonly / writeonly qualifiers of storage buffers and images
+template<typename C>
+static constexpr std::string_view access_qualifier()
+{
+  constexpr bool load = requires { C::load; } || requires { C::readonly; };
+  constexpr bool store = requires { C::store; } || requires { C::writeonly; };
+  if constexpr (load && !store)
+    return "readonly ";
+  else if constexpr (store && !load)
+    return "writeonly ";
+  else
+    return "";
+}
+
+// Compute shaders get every binding ; graphics stages the ones
+// gpu::binding_stages puts there, as in the layout's descriptors
 struct write_bindings
 {
   std::string& shader;
+  gpu::stage_mask stage{gpu::compute_stage};
+  std::string_view vertex{};
+  std::string_view fragment{};
 
   template<typename C>
   void operator()(const C& field) 
   {
+    if (stage != gpu::compute_stage && !(gpu::binding_stages(vertex, fragment, field) & stage))
+      return;
+
     if constexpr (requires { C::sampler2D; }) {
       shader += fmt::format(
           "layout(binding = {}) uniform sampler2D {};\n\n"
@@ -161,10 +557,129 @@ struct write_bindings
 
       shader += fmt::format("}};\n\n");
     } 
+    else if constexpr (requires { C::push_constant; }) {
+      // Laid out as std140 on the host, which std430 matches for the
+      // scalars, vectors and matrices of uniforms
+      shader += fmt::format(
+          "layout(push_constant) uniform {}\n{{\n"
+          , field.name());
+
+      boost::pfr::for_each_field(field, write_binding{shader});
+
+      shader += fmt::format("}};\n\n");
+    }
+    else if constexpr (requires { C::buffer; }) {
+      shader += fmt::format(
+          "layout({}, binding = {}) {}buffer {}\n{{\n"
+          , requires { C::std140; } ? "std140" : "std430"
+          , field.binding()
+          , access_qualifier<C>()
+          , field.name());
+
+      boost::pfr::for_each_field(field, write_binding{shader});
+
+      shader += fmt::format("}};\n\n");
+    }
+    else if constexpr (requires { C::image2D; }) {
+      std::string qualifiers = fmt::format("binding = {}", field.binding());
+      if constexpr (requires { field.format(); })
+        qualifiers += fmt::format(", {}", gpu::format_name(field.format()));
+
+      shader += fmt::format(
+          "layout({}) {}uniform image2D {};\n\n"
+          , qualifiers
+          , access_qualifier<C>()
+          , field.name());
+    }
+  }
+};
+
+// Fixed workgroup size, given by local_size_x/y/z metas on the layout.
+// Layouts specializing it instead get it from write_specialization.
+struct write_local_size
+{
+  std::string& shader;
+
+  template<typename L>
+  void operator()(const L& layout)
+  {
+    if constexpr (requires { layout.local_size_x(); })
+    {
+      int y = 1, z = 1;
+      if constexpr (requires { layout.local_size_y(); })
+        y = layout.local_size_y();
+      if constexpr (requires { layout.local_size_z(); })
+        z = layout.local_size_z();
+
+      shader += fmt::format(
+          "layout(local_size_x = {}, local_size_y = {}, local_size_z = {}) in;\n\n"
+          , layout.local_size_x()
+          , y
+          , z);
+    }
+  }
+};
+
+// Specialization constants, and the workgroup size if it is specialized
+struct write_specialization
+{
+  std::string& shader;
+
+  template<typename Spec>
+  void operator()(const Spec& spec)
+  {
+    std::string local_size;
+    boost::pfr::for_each_field(spec, [&]<typename F>(const F& field) {
+      if constexpr (requires { F::local_size; })
+      {
+        if (!local_size.empty())
+          local_size += ", ";
+        local_size += fmt::format(
+            "local_size_{}_id = {}", F::axis_name(), field.constant_id());
+      }
+      else
+      {
+        shader += fmt::format(
+            "layout(constant_id = {}) const {} {} = {};\n"
+            , field.constant_id()
+            , field_type(field.value)
+            , field.name()
+            , field.value);
+      }
+    });
+
+    if (!local_size.empty())
+      shader += fmt::format("layout({}) in;\n", local_size);
+    shader += "\n";
   }
 };
 
-int main() {
+struct write_default_uniforms
+{
+  std::string& shader;
+  gpu::stage_mask stage;
+  std::string_view vertex;
+  std::string_view fragment;
+  int binding;
+
+  void operator()()
+  {
+    static constexpr auto ubo = gpu::default_uniforms_ubo{};
+    if (!(gpu::binding_stages(vertex, fragment, ubo) & stage))
+      return;
+
+    shader += fmt::format(
+        "layout(std140, binding = {}) uniform {}\n{{\n"
+        , binding
+        , ubo.name());
+
+    boost::pfr::for_each_field(ubo, write_binding{shader});
+
+    shader += fmt::format("}};\n\n");
+  }
+};
+
+int main(int argc, char** argv) {
     examples::GpuFilterExample ex;
 
     std::string vstr = "#version 450\n\n";
@@ -174,7 +689,8 @@ int main() {
     boost::pfr::for_each_field(lay.vertex_input, write_input{vstr}); 
     boost::pfr::for_each_field(lay.vertex_output, write_output{vstr});
     vstr += "\n"; 
-    boost::pfr::for_each_field(lay.bindings, write_bindings{vstr}); 
+    boost::pfr::for_each_field(lay.bindings, write_bindings{vstr, gpu::vertex_stage, ex.vertex(), ex.fragment()}); 
+    write_default_uniforms{vstr, gpu::vertex_stage, ex.vertex(), ex.fragment(), gpu::default_uniforms_binding<layout>()}();
    
     std::cout << "\n --- Vertex --- \n\n" << vstr << ex.vertex() << std::endl;
 
@@ -183,12 +699,237 @@ int main() {
     boost::pfr::for_each_field(lay.fragment_input, write_input{fstr}); 
     boost::pfr::for_each_field(lay.fragment_output, write_output{fstr}); 
     fstr += "\n";
-    boost::pfr::for_each_field(lay.bindings, write_bindings{fstr}); 
+    boost::pfr::for_each_field(lay.bindings, write_bindings{fstr, gpu::fragment_stage, ex.vertex(), ex.fragment()}); 
+    write_default_uniforms{fstr, gpu::fragment_stage, ex.vertex(), ex.fragment(), gpu::default_uniforms_binding<layout>()}();
   
    std::cout << "\n --- Fragment --- \n\n" << fstr << ex.fragment() << std::endl;
 
 
    std::cout << "\n --- Fake commands --- \n" << std::endl;
 
-   handle_update(ex);
+   handle_command backend;
+   frame_context frame;
+   const frame_info info{.render_size = {1280, 720}, .sample_rate = 48000};
+   for (int i = 0; i < 2; i++)
+   {
+     frame.begin_frame(backend, 1.f / 60.f, info);
+     handle_update(ex, backend);
+     frame.end_frame(backend);
+   }
+
+   std::cout << "\n --- Batched uploads --- \n" << std::endl;
+   {
+     gpu::upload_batcher<handle_command> batcher{backend};
+     frame.begin_frame(batcher, 1.f / 60.f, info);
+     handle_update(ex, batcher);
+     frame.end_frame(batcher);
+
+     const auto& stats = batcher.stats();
+     std::cerr << stats.uploads << " uploads (" << stats.upload_bytes << " bytes) -> "
+               << stats.transfers << " transfer (" << stats.transfer_bytes << " bytes), "
+               << stats.copies << " copies\n";
+   }
+
+   // "main --capture frames.gppc" also records a few frames from scratch,
+   // to be replayed with gpp_replay
+   if (argc > 2 && std::string_view{argv[1]} == "--capture")
+   {
+     std::cout << "\n --- Capture --- \n" << std::endl;
+     examples::GpuFilterExample node;
+     frame_context node_frame;
+     gpu::capture_writer capture{backend, argv[2]};
+     for (int i = 0; i < 2; i++)
+     {
+       node_frame.begin_frame(capture, 1.f / 60.f, info);
+       capture.begin(0, gpu::capture_stream::update);
+       handle_update(node, capture);
+       capture.end();
+       node_frame.end_frame(capture);
+     }
+   }
+
+   std::cout << "\n --- Threaded update --- \n" << std::endl;
+   {
+     // update() runs on a control thread, its CPU work on the pool,
+     // the commands on this one
+     gpu::thread_pool pool;
+     gpu::update_channel channel;
+     std::atomic_bool finished{};
+     std::jthread control{[&] {
+       gpu::update_producer producer{channel, &pool};
+       producer.run_update(ex);
+       while (producer.poll() > 0)
+         std::this_thread::yield();
+       finished = true;
+     }};
+
+     while (!finished || channel.commands.size() > 0)
+       channel.consume(backend);
+   }
+
+   std::cout << "\n --- Mesh optimization --- \n" << std::endl;
+   {
+     // Half-precision positions and 16-bit texcoords
+     struct quantized_input {
+       gpp_attribute(0, v_position, gpu::half[3], position) pos;
+       gpp_attribute(1, v_texcoord, gpu::unorm16[2], texcoord) tex;
+     };
+     std::string qstr;
+     boost::pfr::for_each_field(quantized_input{}, write_input{qstr});
+     std::cout << qstr << std::endl;
+
+     // A grid whose triangles come in no particular order
+     constexpr int n = 64;
+     std::vector<float> positions, texcoords;
+     for (int y = 0; y <= n; y++)
+       for (int x = 0; x <= n; x++)
+       {
+         positions.insert(positions.end(), {x / float(n) * 2.f - 1.f, y / float(n) * 2.f - 1.f, 0.f});
+         texcoords.insert(texcoords.end(), {x / float(n), y / float(n)});
+       }
+     std::vector<std::array<std::uint32_t, 3>> triangles;
+     for (std::uint32_t y = 0; y < n; y++)
+       for (std::uint32_t x = 0; x < n; x++)
+       {
+         const std::uint32_t i = y * (n + 1) + x;
+         triangles.push_back({i, i + 1, i + n + 1});
+         triangles.push_back({i + 1, i + n + 2, i + n + 1});
+       }
+     std::srand(1);
+     for (std::size_t i = triangles.size() - 1; i > 0; i--)
+       std::swap(triangles[i], triangles[std::rand() % (i + 1)]);
+
+     gpu::mesh_optimizer<quantized_input> mesh;
+     mesh.optimize(
+         {positions.data(), texcoords.data()}, positions.size() / 3,
+         triangles.front().data(), triangles.size() * 3);
+
+     const auto& stats = mesh.stats();
+     std::cerr << fmt::format(
+         "{} vertices, {} {}-bit indices ; ACMR {:.2f} -> {:.2f} ; {} -> {} bytes ({} saved)\n"
+         , mesh.vertex_count(), mesh.index_count()
+         , mesh.index_type() == gpu::index_format::uint16 ? 16 : 32
+         , stats.acmr_before, stats.acmr_after
+         , stats.input_bytes, stats.output_bytes, stats.saved_bytes());
+   }
+
+   std::cout << "\n --- Interleaved update --- \n" << std::endl;
+   {
+     // While one node's pixels are generated on a worker, the other's
+     // commands go on
+     examples::GpuFilterExample a, b;
+     gpu::thread_pool pool;
+     gpu::update_runner runner{pool};
+     runner.run_update(a);
+     runner.run_update(b);
+     runner.finish(backend);
+   }
+
+   examples::GpuComputeExample cex;
+
+   using compute_layout = examples::GpuComputeExample::layout;
+   static constexpr auto clay = compute_layout{};
+   std::string cstr = "#version 450\n\n";
+   write_specialization{cstr}(clay.specialization);
+   write_local_size{cstr}(clay);
+   boost::pfr::for_each_field(clay.bindings, write_bindings{cstr, gpu::compute_stage});
+
+   std::cout << "\n --- Compute --- \n\n" << cstr << cex.compute() << std::endl;
+
+   static constexpr auto rlay = gpu::reduction::layout{};
+   std::string rstr = "#version 450\n\n";
+   write_local_size{rstr}(rlay);
+   boost::pfr::for_each_field(rlay.bindings, write_bindings{rstr, gpu::compute_stage});
+
+   std::cout << "\n --- Reduction --- \n\n" << rstr << gpu::reduction{}.compute() << std::endl;
+
+   std::cout << "\n --- Filter descriptors --- \n" << std::endl;
+   for (const auto& d : gpu::make_descriptors<layout>(ex.vertex(), ex.fragment()))
+   {
+     std::cout << fmt::format(
+         "binding {} ; location {} ; kind {} ; stages {} ; size {} ; {}\n"
+         , d.binding, d.location, int(d.kind), int(d.stages), d.size, d.name);
+   }
+
+   std::cout << "\n --- Compute descriptors --- \n" << std::endl;
+   for (const auto& d : gpu::descriptors<compute_layout>)
+   {
+     std::cout << fmt::format(
+         "binding {} ; kind {} ; stages {} ; access {} ; size {} ; {}\n"
+         , d.binding, int(d.kind), int(d.stages), int(d.access), d.size, d.name);
+   }
+
+   std::cout << "\n --- Fake compute commands --- \n" << std::endl;
+
+   backend.specialization = gpu::specialization_state{clay.specialization};
+   handle_update(cex, backend);
+
+   gpu::pass_timings timings;
+   timings.begin(backend, 1);
+   handle_dispatch(cex, backend);
+   timings.end(backend, 1);
+   timings.collect(backend);
+
+   std::cout << "\n --- Pass timings --- \n" << std::endl;
+   for (const auto& t : timings.report())
+   {
+     std::cout << fmt::format(
+         "node {} ; {} samples ; p50 {:.3f} ms ; p99 {:.3f} ms\n"
+         , t.node, t.samples, t.p50_ms, t.p99_ms);
+   }
+
+   std::cout << "\n --- Respecialized compute --- \n" << std::endl;
+   {
+     // Smaller cells: new buffers, and the pipeline is specialized again
+     cex.downscale = 8;
+     handle_update(cex, backend);
+     handle_dispatch(cex, backend);
+   }
+
+   std::cout << "\n --- Tiled compute --- \n" << std::endl;
+   {
+     // Too large for the node's textures: streamed tile by tile
+     std::vector<std::uint8_t> image(2500 * 1500 * 4, 128);
+     examples::GpuComputeExample tiled;
+     tiled.source = {.data = image.data(), .width = 2500, .height = 1500};
+
+     handle_update(tiled, backend);
+     handle_dispatch(tiled, backend);
+
+     const gpu::tile_grid grid{2500, 1500, examples::GpuComputeExample::tile_size};
+     std::cerr << fmt::format(
+         "{}x{} image -> {} tiles ; {} bytes of tile textures\n"
+         , tiled.source.width, tiled.source.height, grid.size()
+         , 2 * gpu::texture_bytes(gpu::texture_format::rgba32f, grid.max_source_width(), grid.max_source_height()));
+   }
+
+   std::cout << "\n --- Frame budget --- \n" << std::endl;
+   {
+     // Far too little for both nodes: the filter has to run every frame,
+     // the analysis, of low priority, only when it reaches its
+     // max_update_interval
+     examples::GpuFilterExample filter;
+     examples::GpuComputeExample analysis;
+     gpu::node_scheduler<handle_command> scheduler{std::chrono::microseconds{1}};
+     const int filter_id = scheduler.add(filter, {.max_update_interval = 1});
+     const int analysis_id = scheduler.add(analysis);
+
+     std::string ran;
+     for (int frame = 0; frame < 8; frame++)
+     {
+       const auto analysis_runs = scheduler.stats(analysis_id).runs;
+       scheduler.run_frame(backend);
+       backend.end_frame();
+       ran += scheduler.stats(analysis_id).runs > analysis_runs ? 'A' : '.';
+     }
+
+     for (auto [label, id] : {std::pair{"filter", filter_id}, std::pair{"analysis", analysis_id}})
+     {
+       const auto& s = scheduler.stats(id);
+       std::cerr << fmt::format(
+           "{}: {} runs, {} skipped ; {:.3f} ms per run\n"
+           , label, s.runs, s.skips, s.cost.count() * 1e-6);
+     }
+     std::cerr << "analysis ran in frames: " << ran << "\n";
+   }
  }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 #include "helpers.hpp"
+#include <cstring>
+#include <random>
 
 
 namespace examples
@@ -138,17 +140,15 @@ void main()
     return R"_(
 void main()
 {
-  fragColor = vec4(texture(tex, texcoord.xy).rgb, 1.0) ;
+  fragColor = vec4(texture(tex, texcoord.xy).rgb * (0.5 + 0.5 * sin(gpp_time)), 1.0) ;
 }
 )_";
   }
 
 
-  std::vector<float> buf;
-  std::vector<uint8_t> tex;
-
   gpu::buffer_handle buf_handle{};
   gpu::texture_handle tex_handle{};
+  std::minstd_rand rng;
 
   gpu::co_update update()
   {
@@ -156,9 +156,6 @@ void main()
 
     if (!buf_handle)
     {
-      // Resize our local, CPU-side buffer
-      buf.resize(ubo_size);
-
       // Request the creation of a GPU buffer
       this->buf_handle = co_yield gpu::dynamic_ubo_allocation{
           .binding = gpu::binding<bindings::custom_ubo>()
@@ -166,35 +163,51 @@ void main()
       };
     }
 
-    // Upload some data into it
+    // Fill some memory provided by the backend for this frame:
+    // no need to keep a CPU-side copy of the data in the node
+    auto ubo_data = co_yield gpu::allocate_staging{.size = ubo_size};
+    std::memset(ubo_data.data, 0, ubo_size);
+
+    // Upload it
     co_yield gpu::dynamic_ubo_upload{
         .handle = buf_handle,
         .offset = 0,
         .size = ubo_size,
-        .data = buf.data()
+        .data = ubo_data.data
     };
 
     // Same for the texture
-    int sz = 16*16*4;
+    constexpr auto format = gpu::texture_format::rgba8;
+    constexpr int sz = gpu::texture_bytes(format, 16, 16);
     if(!tex_handle)
     {
       this->tex_handle = co_yield gpu::texture_allocation{
           .binding = gpu::binding<bindings::sampler>()
         , .width = 16
         , .height = 16
+        , .format = format
+        , .mip_levels = 0
       };
     }
 
-    tex.resize(sz);
-    for(int i = 0; i < sz; i++)
-      tex[i] = rand();
+    auto pixels = co_yield gpu::allocate_staging{.size = sz};
+
+    // Generate the pixels on a worker thread: the host goes on with other nodes
+    co_yield gpu::cpu_task{[&] {
+      auto tex = static_cast<uint8_t*>(pixels.data);
+      for(int i = 0; i < sz; i++)
+        tex[i] = rng();
+    }};
 
     co_yield gpu::texture_upload{
         .handle = tex_handle
       , .offset = 0
       , .size = sz
-      , .data = tex.data()
+      , .data = pixels.data
     };
+
+    // The texture is minified when drawn: sample it from its mip chain
+    co_yield gpu::generate_mips{.handle = tex_handle};
   }
 };
 
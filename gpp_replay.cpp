@@ -0,0 +1,151 @@
+// Replays a command stream recorded with gpu::capture_writer,
+// as fast as possible, to benchmark backends on real workloads:
+//
+//   gpp_replay [--backend cpu|null] [--repeat N] capture.gppc
+#include "capture.hpp"
+#include "cpu_backend.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+// Does nothing but hand out handles: measures the cost of the replay itself
+struct null_backend
+{
+  std::uintptr_t next_handle{};
+
+  template <typename C>
+  typename C::return_type operator()(const C&)
+  {
+    using R = typename C::return_type;
+    if constexpr (std::is_void_v<R>)
+      return;
+    else if constexpr (std::is_pointer_v<R>)
+      return reinterpret_cast<R>(++next_handle);
+    else if constexpr (requires { R{}.handle; })
+      return R{.handle = reinterpret_cast<decltype(R{}.handle)>(++next_handle)};
+    else
+      return R{};
+  }
+};
+
+// The capture, mapped copy-on-write: backends get non-const payload pointers
+class mapped_file
+{
+public:
+  explicit mapped_file(const char* path)
+  {
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+      return;
+
+    struct stat st{};
+    if (::fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+      void* ptr = ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      if (ptr != MAP_FAILED)
+      {
+        m_data = static_cast<char*>(ptr);
+        m_size = st.st_size;
+        ::madvise(ptr, m_size, MADV_SEQUENTIAL);
+      }
+    }
+    ::close(fd);
+  }
+
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  ~mapped_file()
+  {
+    if (m_data)
+      ::munmap(m_data, m_size);
+  }
+
+  char* data() const noexcept { return m_data; }
+  std::size_t size() const noexcept { return m_size; }
+
+private:
+  char* m_data{};
+  std::size_t m_size{};
+};
+
+template <typename Backend>
+int replay(const mapped_file& file, int repeat)
+{
+  using clock = std::chrono::steady_clock;
+  long commands = 0;
+  clock::duration elapsed{};
+  for (int i = 0; i < repeat; i++)
+  {
+    // Every run starts from an empty backend, as the capture did
+    Backend backend;
+    gpu::capture_reader reader{file.data(), file.size()};
+
+    const auto t0 = clock::now();
+    const long count = reader.replay(backend);
+    elapsed += clock::now() - t0;
+
+    if (count < 0)
+    {
+      std::fprintf(stderr, "corrupt capture\n");
+      return 1;
+    }
+    commands += count;
+  }
+
+  const double seconds = std::chrono::duration<double>(elapsed).count();
+  std::printf(
+      "%ld commands in %.3f ms: %.0f commands/s, %.1f MB/s\n", commands, seconds * 1e3,
+      commands / seconds, repeat * file.size() / seconds / 1e6);
+  return 0;
+}
+}
+
+int main(int argc, char** argv)
+{
+  std::string_view backend = "cpu";
+  int repeat = 1;
+  const char* path = nullptr;
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string_view arg = argv[i];
+    if (arg == "--backend" && i + 1 < argc)
+      backend = argv[++i];
+    else if (arg == "--repeat" && i + 1 < argc)
+      repeat = std::max(1, std::stoi(argv[++i]));
+    else
+      path = argv[i];
+  }
+
+  if (!path)
+  {
+    std::fprintf(stderr, "usage: %s [--backend cpu|null] [--repeat N] capture.gppc\n", argv[0]);
+    return 1;
+  }
+
+  mapped_file file{path};
+  if (!file.data() || !gpu::capture_reader{file.data(), file.size()}.valid())
+  {
+    std::fprintf(stderr, "%s: not a capture\n", path);
+    return 1;
+  }
+
+  if (backend == "cpu")
+    return replay<gpu::cpu_backend>(file, repeat);
+  if (backend == "null")
+    return replay<null_backend>(file, repeat);
+
+  std::fprintf(stderr, "unknown backend: %s\n", std::string(backend).c_str());
+  return 1;
+}
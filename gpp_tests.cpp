@@ -0,0 +1,1545 @@
+// Checks of the command streams and helpers, run on gpu::cpu_backend:
+// no device is needed.
+//
+//   ctest, or ./gpp_tests
+#include "capture.hpp"
+#include "command_queue.hpp"
+#include "content_store.hpp"
+#include "cpu_backend.hpp"
+#include "cpu_tasks.hpp"
+#include "descriptors.hpp"
+#include "gpp-compute.hpp"
+#include "gpp-helpers.hpp"
+#include "input_tracking.hpp"
+#include "memory_budget.hpp"
+#include "mesh_optimizer.hpp"
+#include "reduction.hpp"
+#include "scheduler.hpp"
+#include "specialization.hpp"
+#include "texture_conversion.hpp"
+#include "tiling.hpp"
+#include "timings.hpp"
+#include "triple_buffer.hpp"
+#include "upload_batcher.hpp"
+#include "vertex_packer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+int failures = 0;
+
+#define GPP_CHECK(condition) check(condition, #condition, __LINE__)
+
+void check(bool ok, const char* what, int line)
+{
+  if (!ok)
+  {
+    std::fprintf(stderr, "gpp_tests.cpp:%d: check failed: %s\n", line, what);
+    failures++;
+  }
+}
+
+template <typename Exception, typename F>
+bool throws(F&& f)
+{
+  try
+  {
+    f();
+  }
+  catch (const Exception&)
+  {
+    return true;
+  }
+  return false;
+}
+
+// Counts what reaches the backend
+template <typename Backend>
+struct counting_backend
+{
+  Backend& backend;
+  int allocations{};
+  int releases{};
+
+  template <typename C>
+  typename C::return_type operator()(const C& command)
+  {
+    if constexpr (requires { C::allocation; } && !requires { C::staging; })
+      allocations++;
+    else if constexpr (requires { C::deallocation; })
+      releases++;
+    return backend(command);
+  }
+
+  bool owns_staging(const void* ptr) const { return backend.owns_staging(ptr); }
+  void end_frame() { backend.end_frame(); }
+};
+
+template <typename Node, typename Backend>
+void run_update(Node& node, Backend& backend)
+{
+  for (auto& promise : node.update())
+    promise.feedback_value = gpu::execute<gpu::update_handle>(backend, promise.current_command);
+}
+
+template <typename Node, typename Backend>
+void run_dispatch(Node& node, Backend& backend)
+{
+  for (auto& promise : node.dispatch())
+    promise.feedback_value = gpu::execute<gpu::dispatch_handle>(backend, promise.current_command);
+}
+
+// What the reduction shader does for each workgroup of a dispatch
+void reduction_kernel(gpu::cpu_backend& backend, int x, int, int)
+{
+  using value_type = gpu::reduction::value_type;
+  constexpr int local_size = gpu::reduction::local_size;
+
+  auto src = reinterpret_cast<const value_type*>(backend.bound_buffers.at(0).data());
+  auto dst = reinterpret_cast<value_type*>(backend.bound_buffers.at(1).data());
+  const int n = backend.bound_buffers.at(0).size() / sizeof(value_type);
+  for (int group = 0; group < x; group++)
+  {
+    float partial[local_size][4]{};
+    for (int local = 0; local < local_size; local++)
+    {
+      const int index = group * local_size + local;
+      if (index < n)
+        std::memcpy(partial[local], src[index], sizeof(value_type));
+    }
+    for (int stride = local_size / 2; stride > 0; stride /= 2)
+      for (int local = 0; local < stride; local++)
+        for (int c = 0; c < 4; c++)
+          partial[local][c] += partial[local + stride][c];
+    std::memcpy(dst[group], partial[0], sizeof(value_type));
+  }
+}
+
+// The passes of the reduction node, as dispatched, give the same bits as
+// reduction::reference, for one to three passes and partial workgroups
+void test_reduction()
+{
+  gpu::cpu_backend cpu;
+  cpu.kernel = reduction_kernel;
+  counting_backend<gpu::cpu_backend> backend{cpu};
+
+  std::minstd_rand rng{29};
+  std::uniform_real_distribution<float> dist{-1.f, 1.f};
+
+  gpu::reduction node;
+  for (int count : {1, 3, 255, 257, 1000, 70001, 513})
+  {
+    std::vector<float> values(count * 4);
+    for (auto& v : values)
+      v = dist(rng);
+
+    auto source = cpu(gpu::static_allocation{.binding = 0, .size = int(values.size() * sizeof(float))});
+    cpu(gpu::static_upload{
+        .handle = source, .offset = 0, .size = int(values.size() * sizeof(float)), .data = values.data()});
+
+    node.source = source;
+    node.count = count;
+    run_update(node, backend);
+    run_dispatch(node, backend);
+    const auto view = cpu(node.result);
+
+    const auto expected = gpu::reduction::reference(
+        reinterpret_cast<const gpu::reduction::value_type*>(values.data()), count);
+    GPP_CHECK(view.size == sizeof(expected));
+    GPP_CHECK(std::memcmp(view.data, expected.data(), sizeof(expected)) == 0);
+
+    cpu(gpu::buffer_release{.handle = source});
+  }
+
+  // Allocated for 1, 3, 255, 257, 1000, 70001: 513 reuses the buffers
+  GPP_CHECK(backend.allocations == 2 * 6);
+  GPP_CHECK(backend.releases == 2 * 5);
+
+  for (auto& promise : node.release())
+    gpu::execute<gpu::update_handle>(backend, promise.current_command);
+  GPP_CHECK(backend.releases == 2 * 6);
+}
+
+// Copies move exactly their region, and refuse anything out of range
+void test_texture_copies()
+{
+  gpu::cpu_backend backend;
+
+  // 16x16 with a full mip chain: 1364 bytes of storage
+  auto tex = backend(gpu::texture_allocation{
+      .binding = 0, .width = 16, .height = 16, .format = gpu::texture_format::r8, .mip_levels = 0});
+  auto buf = backend(gpu::static_allocation{.binding = 0, .size = 1024});
+
+  std::vector<char> pixels(16 * 16);
+  for (std::size_t i = 0; i < pixels.size(); i++)
+    pixels[i] = char(i);
+  backend(gpu::static_upload{.handle = buf, .offset = 0, .size = 256, .data = pixels.data()});
+
+  // Whole first level, then a 4x2 rectangle of the third one
+  backend(gpu::copy_buffer_to_texture{.src = buf, .src_offset = 0, .dst = tex, .size = 256});
+  GPP_CHECK(std::memcmp(backend.get(tex).data.data(), pixels.data(), 256) == 0);
+
+  backend(gpu::copy_buffer_to_texture{
+      .src = buf, .src_offset = 8, .dst = tex, .size = 8,
+      .x = 0, .y = 1, .width = 4, .height = 2, .mip_level = 2});
+  backend(gpu::copy_texture_to_buffer{
+      .src = tex, .dst = buf, .dst_offset = 512, .size = 8,
+      .x = 0, .y = 1, .width = 4, .height = 2, .mip_level = 2});
+  GPP_CHECK(std::memcmp(backend.get(buf).data.data() + 512, pixels.data() + 8, 8) == 0);
+
+  // The level before the rectangle was not touched
+  GPP_CHECK(backend.get(tex).subresource(0, 2)[0] == 0);
+
+  GPP_CHECK(throws<std::out_of_range>([&] {
+    backend(gpu::copy_buffer_to_texture{.src = buf, .src_offset = 1000, .dst = tex, .size = 256});
+  }));
+  GPP_CHECK(throws<std::out_of_range>([&] {
+    backend(gpu::copy_texture_to_buffer{.src = tex, .dst = buf, .dst_offset = 800, .size = 256});
+  }));
+  GPP_CHECK(throws<std::out_of_range>([&] {
+    backend(gpu::copy_buffer_to_texture{
+        .src = buf, .src_offset = 0, .dst = tex, .size = 16, .x = 14, .y = 0, .width = 4, .height = 4});
+  }));
+  GPP_CHECK(throws<std::out_of_range>([&] {
+    backend(gpu::copy_buffer_to_texture{.src = buf, .src_offset = 0, .dst = tex, .size = 1, .mip_level = 5});
+  }));
+  GPP_CHECK(throws<std::invalid_argument>([&] {
+    backend(gpu::copy_texture_to_buffer{.src = tex, .dst = buf, .dst_offset = 0, .size = 1024});
+  }));
+  GPP_CHECK(backend.get(buf).data.size() == 1024);
+
+  // rg8 has no conversion from rgba8
+  auto rg = backend(gpu::texture_allocation{
+      .binding = 0, .width = 2, .height = 2, .format = gpu::texture_format::rg8});
+  GPP_CHECK(throws<std::invalid_argument>([&] {
+    backend(gpu::texture_upload{
+        .handle = rg, .offset = 0, .size = 16, .data = pixels.data(),
+        .data_format = gpu::texture_format::rgba8});
+  }));
+}
+
+// Runs a conversion kernel over the whole of src, then one element at a time,
+// which only goes through its scalar loop: both must give the same bits
+template <int In, int Out, typename T, typename U>
+bool matches_scalar(void (*kernel)(const T*, U*, std::size_t), const std::vector<T>& src)
+{
+  const std::size_t n = src.size() / In;
+  std::vector<U> simd(n * Out), scalar(n * Out);
+  kernel(src.data(), simd.data(), n);
+  for (std::size_t i = 0; i < n; i++)
+    kernel(src.data() + i * In, scalar.data() + i * Out, 1);
+  return std::ranges::equal(std::as_bytes(std::span(simd)), std::as_bytes(std::span(scalar)));
+}
+
+// The SSE / F16C kernels agree with their scalar loops, tails and special
+// values included ; the build enables SSSE3 and F16C for these to be compared
+void test_conversion_kernels()
+{
+  using namespace gpu::conversion;
+  constexpr float inf = std::numeric_limits<float>::infinity();
+  const float floats[]{
+      std::numeric_limits<float>::quiet_NaN(), -std::numeric_limits<float>::quiet_NaN(),
+      std::bit_cast<float>(0x7fa00001u), std::bit_cast<float>(0xffc12345u),
+      inf, -inf, std::numeric_limits<float>::denorm_min(), -std::numeric_limits<float>::min(),
+      1e-6f, 6.1e-5f, 65504.f, 65520.f, -0.f, 0.5f, 1.f, 1.5f, -0.25f, 127.5f / 255.f};
+  const std::uint16_t halves[]{
+      0x7c01, 0x7e00, 0xfe3f, 0x7c00, 0xfc00, 0x0001, 0x03ff, 0x8001, 0x8000, 0x3c00, 0x7bff};
+
+  std::mt19937 rng{32};
+  for (std::size_t n : {0, 1, 3, 4, 5, 15, 16, 17, 31, 33, 67})
+  {
+    std::vector<std::uint8_t> bytes(n * 4);
+    for (auto& b : bytes)
+      b = std::uint8_t(rng());
+
+    std::vector<float> f(n * 4);
+    std::uniform_real_distribution<float> dist{-0.5f, 1.5f};
+    for (std::size_t i = 0; i < f.size(); i++)
+      f[i] = i % 3 == 0 ? floats[i / 3 % std::size(floats)] : dist(rng);
+
+    std::vector<std::uint16_t> h(n * 4);
+    for (std::size_t i = 0; i < h.size(); i++)
+      h[i] = i % 3 == 0 ? halves[i / 3 % std::size(halves)] : std::uint16_t(rng());
+
+    GPP_CHECK((matches_scalar<3, 4>(rgb8_to_rgba8, std::vector(bytes.begin(), bytes.begin() + n * 3))));
+    GPP_CHECK((matches_scalar<4, 4>(swap_red_blue, bytes)));
+    GPP_CHECK((matches_scalar<1, 1>(u8_to_f32, bytes)));
+    GPP_CHECK((matches_scalar<1, 1>(f32_to_u8, f)));
+    GPP_CHECK((matches_scalar<1, 1>(f32_to_f16, f)));
+    GPP_CHECK((matches_scalar<1, 1>(f16_to_f32, h)));
+
+    std::vector<std::uint8_t> premultiplied{bytes}, expected{bytes};
+    premultiply_rgba8(premultiplied.data(), n);
+    for (std::size_t i = 0; i < n; i++)
+      premultiply_rgba8(expected.data() + i * 4, 1);
+    GPP_CHECK(premultiplied == expected);
+
+    // The SSE path of premultiply_rgba32f works one pixel at a time
+    std::vector<float> premultiplied_f{f}, expected_f{f};
+    premultiply_rgba32f(premultiplied_f.data(), n);
+    for (std::size_t i = 0; i < n * 4; i++)
+      if (i % 4 != 3)
+        expected_f[i] *= f[i / 4 * 4 + 3];
+    GPP_CHECK(std::ranges::equal(
+        std::as_bytes(std::span(premultiplied_f)), std::as_bytes(std::span(expected_f))));
+  }
+
+  // NaNs are quieted and keep the top of their payload, both ways
+  GPP_CHECK(f32_to_f16(std::bit_cast<float>(0x7fa00001u)) == 0x7f00);
+  GPP_CHECK(f32_to_f16(std::bit_cast<float>(0xffc12345u)) == 0xfe09);
+  GPP_CHECK(std::bit_cast<std::uint32_t>(f16_to_f32(std::uint16_t(0x7c01))) == 0x7fc02000u);
+  GPP_CHECK(f32_to_f16(65520.f) == 0x7c00);
+  GPP_CHECK(f32_to_f16(std::numeric_limits<float>::denorm_min()) == 0);
+  GPP_CHECK(f16_to_f32(std::uint16_t(0x0001)) == 0x1p-24f);
+}
+
+// The ring holds exactly its capacity, and stays in order across wraps,
+// whether the cached indices are still valid or have to be refreshed
+void test_spsc_queue()
+{
+  gpu::spsc_queue<int, 4> queue;
+  int value{};
+  GPP_CHECK(!queue.try_pop(value));
+
+  int pushed = 0, popped = 0;
+  for (; pushed < 4; pushed++)
+    GPP_CHECK(queue.try_push(pushed));
+  GPP_CHECK(!queue.try_push(-1));
+  GPP_CHECK(queue.size() == 4);
+
+  // Uneven batches, so that the full and empty checks land everywhere in the ring
+  for (int round = 0; round < 12; round++)
+  {
+    const int pops = 1 + round % 4;
+    for (int i = 0; i < pops; i++)
+    {
+      GPP_CHECK(queue.try_pop(value));
+      GPP_CHECK(value == popped++);
+    }
+    while (queue.try_push(pushed))
+      pushed++;
+    GPP_CHECK(queue.size() == 4);
+  }
+  GPP_CHECK(pushed > 4 * 4);
+
+  while (queue.try_pop(value))
+    GPP_CHECK(value == popped++);
+  GPP_CHECK(popped == pushed && queue.size() == 0);
+  GPP_CHECK(queue.try_push(pushed));
+  GPP_CHECK(queue.try_pop(value) && value == pushed);
+}
+
+// Keeps the handles a backend returns, in order, and checks where the
+// payloads it receives point to
+template <typename Backend>
+struct handle_log
+{
+  Backend& backend;
+  std::vector<void*> handles{};
+  long commands{};
+  const char* payloads{};
+  bool aligned{true};
+
+  template <typename C>
+  typename C::return_type operator()(const C& command)
+  {
+    commands++;
+    if constexpr (requires { command.data; })
+      if (payloads && command.data)
+        aligned = aligned && (static_cast<const char*>(command.data) - payloads)
+                                     % gpu::capture_format::payload_alignment == 0;
+
+    if constexpr (std::is_void_v<typename C::return_type>)
+    {
+      backend(command);
+    }
+    else
+    {
+      auto result = backend(command);
+      handles.push_back(const_cast<void*>(gpu::capture_format::result_handle(result)));
+      return result;
+    }
+  }
+};
+
+// A frame recorded with capture_writer and replayed with capture_reader
+// leaves the backend with the same resources
+void test_capture_round_trip()
+{
+  const auto path = std::filesystem::temp_directory_path() / "gpp_tests.gppc";
+  std::vector<char> pixels(4 * 4 * 4);
+  for (std::size_t i = 0; i < pixels.size(); i++)
+    pixels[i] = char(i * 7);
+
+  gpu::cpu_backend recorded;
+  handle_log<gpu::cpu_backend> recording{recorded};
+  {
+    gpu::capture_writer capture{recording, path.string()};
+    GPP_CHECK(bool(capture));
+    capture.begin(3, gpu::capture_stream::update);
+
+    auto tex = capture(gpu::texture_allocation{.binding = 1, .width = 4, .height = 4});
+    auto a = capture(gpu::static_allocation{.binding = 0, .size = 64});
+    auto b = capture(gpu::static_allocation{.binding = 0, .size = 64});
+
+    // Odd sizes and offsets, so that payloads do not follow each other aligned
+    capture(gpu::static_upload{.handle = a, .offset = 3, .size = 13, .data = pixels.data()});
+    capture(gpu::buffer_release{.handle = a});
+
+    // Likely at the address of "a": it must still replay as a new resource
+    auto c = capture(gpu::static_allocation{.binding = 2, .size = 32});
+    capture(gpu::static_upload{.handle = b, .offset = 1, .size = 7, .data = pixels.data() + 5});
+    capture(gpu::static_upload{.handle = c, .offset = 0, .size = 32, .data = pixels.data() + 9});
+    capture(gpu::copy_buffer{.src = c, .src_offset = 4, .dst = b, .dst_offset = 40, .size = 20});
+    capture.end();
+    capture(gpu::texture_upload{
+        .handle = tex, .offset = 0, .size = int(pixels.size()), .data = pixels.data()});
+    capture.end_frame();
+  }
+
+  std::vector<char> file(std::filesystem::file_size(path));
+  std::ifstream{path, std::ios::binary}.read(file.data(), file.size());
+  std::filesystem::remove(path);
+
+  gpu::capture_reader reader{file.data(), file.size()};
+  GPP_CHECK(reader.valid());
+
+  gpu::cpu_backend replayed;
+  handle_log<gpu::cpu_backend> replaying{replayed};
+  replaying.payloads = file.data();
+  GPP_CHECK(reader.replay(replaying) == recording.commands);
+  GPP_CHECK(replaying.aligned);
+  GPP_CHECK(replaying.handles.size() == 4);
+
+  // Allocation order: tex, a (released), b, c
+  if (replaying.handles.size() == 4)
+  {
+    auto texture_of = [](auto& backend, void* handle) -> auto&
+    { return backend.get(static_cast<gpu::texture_handle>(handle)); };
+    auto buffer_of = [](auto& backend, void* handle) -> auto&
+    { return backend.get(static_cast<gpu::buffer_handle>(handle)); };
+
+    auto& t0 = texture_of(recorded, recording.handles[0]);
+    auto& t1 = texture_of(replayed, replaying.handles[0]);
+    GPP_CHECK(t0.width == t1.width && t0.height == t1.height && t0.binding == t1.binding);
+    GPP_CHECK(t0.data == t1.data && t1.data.size() == pixels.size());
+
+    for (int i : {2, 3})
+    {
+      auto& b0 = buffer_of(recorded, recording.handles[i]);
+      auto& b1 = buffer_of(replayed, replaying.handles[i]);
+      GPP_CHECK(b0.binding == b1.binding && b0.data == b1.data);
+    }
+    GPP_CHECK(buffer_of(replayed, replaying.handles[3]).data.size() == 32);
+    GPP_CHECK(std::memcmp(buffer_of(replayed, replaying.handles[2]).data.data() + 40,
+                          pixels.data() + 13, 20) == 0);
+  }
+
+  // A truncated capture is reported, not replayed past its end
+  gpu::cpu_backend truncated;
+  gpu::capture_reader cut{file.data(), file.size() - 8};
+  GPP_CHECK(cut.replay(truncated) == -1);
+}
+
+// Awaited readbacks are reused by the next requests
+void test_readback_recycling()
+{
+  gpu::cpu_backend backend;
+  auto buf = backend(gpu::static_allocation{.binding = 0, .size = 64});
+
+  const char* first{};
+  for (int i = 0; i < 100; i++)
+  {
+    auto view = backend(backend(gpu::readback_buffer{.handle = buf, .offset = 0, .size = 64}));
+    GPP_CHECK(view.size == 64);
+    if (i == 0)
+      first = view.data;
+    GPP_CHECK(view.data == first);
+  }
+
+  // Two in flight at once get their own storage
+  auto a = backend(gpu::readback_buffer{.handle = buf, .offset = 0, .size = 16});
+  auto b = backend(gpu::readback_buffer{.handle = buf, .offset = 0, .size = 32});
+  GPP_CHECK(backend(a).data != backend(b).data);
+}
+
+// Large levels split across a thread pool give the same chain as serially
+void test_mipmaps()
+{
+  gpu::thread_pool pool{3};
+  gpu::cpu_backend serial, pooled;
+  pooled.workers = &pool;
+
+  std::vector<std::uint8_t> pixels(1024 * 1024 * 4);
+  std::minstd_rand rng{33};
+  for (auto& p : pixels)
+    p = rng();
+
+  std::vector<char>* chains[2];
+  int i = 0;
+  for (auto* backend : {&serial, &pooled})
+  {
+    auto tex = (*backend)(gpu::texture_allocation{
+        .binding = 0, .width = 1024, .height = 1024, .mip_levels = 0});
+    (*backend)(gpu::texture_upload{
+        .handle = tex, .offset = 0, .size = int(pixels.size()), .data = pixels.data()});
+    (*backend)(gpu::generate_mips{.handle = tex});
+    chains[i++] = &backend->get(tex).data;
+  }
+  GPP_CHECK(*chains[0] == *chains[1]);
+
+  // 2x2 averages of the first level
+  auto& level1 = *chains[1];
+  const int expected = (pixels[0] + pixels[4] + pixels[4096] + pixels[4100] + 2) / 4;
+  GPP_CHECK(std::uint8_t(level1[1024 * 1024 * 4]) == expected);
+}
+
+// A lookup table the shader reads, and a result it writes
+struct storage_layout
+{
+  halp_flags(compute);
+  struct bindings
+  {
+    struct {
+      halp_meta(name, "lut");
+      halp_meta(binding, 0);
+      halp_flags(std430, buffer, readonly);
+      gpu::uniform<"lut", float*> values;
+    } lut;
+
+    struct {
+      halp_meta(name, "out");
+      halp_meta(binding, 1);
+      halp_flags(std430, buffer, load, store);
+      gpu::uniform<"result", float*> values;
+    } out;
+  } bindings;
+};
+
+template <typename Backend>
+std::vector<float> read_buffer(Backend& backend, gpu::buffer_handle handle, int size)
+{
+  auto view = backend(backend(gpu::readback_buffer{.handle = handle, .offset = 0, .size = size}));
+  std::vector<float> values(size / sizeof(float));
+  std::memcpy(values.data(), view.data, size);
+  return values;
+}
+
+// Identical read-only buffers are shared until one is written to ;
+// buffers the shader writes never are
+void test_content_store()
+{
+  gpu::cpu_backend cpu;
+  counting_backend<gpu::cpu_backend> backend{cpu};
+  gpu::content_store store{backend};
+
+  std::vector<float> lut(64, 1.f);
+  const int size = lut.size() * sizeof(float);
+  store.begin<storage_layout>();
+
+  gpu::buffer_handle luts[2], results[2];
+  for (int node = 0; node < 2; node++)
+  {
+    luts[node] = store(gpu::static_allocation{.binding = 0, .size = size});
+    store(gpu::static_upload{.handle = luts[node], .offset = 0, .size = size, .data = lut.data()});
+
+    std::vector<float> zeros(64);
+    results[node] = store(gpu::static_allocation{.binding = 1, .size = size});
+    store(gpu::static_upload{.handle = results[node], .offset = 0, .size = size, .data = zeros.data()});
+  }
+
+  // One shared lookup table, two results
+  GPP_CHECK(store.stats().resources == 1);
+  GPP_CHECK(store.stats().references == 2);
+  GPP_CHECK(backend.allocations == 3);
+  GPP_CHECK(results[0] != results[1]);
+
+  // Copy on write: the other node still sees the original table
+  const float two = 2.f;
+  store(gpu::static_upload{.handle = luts[1], .offset = 4, .size = sizeof(two), .data = (void*)&two});
+  GPP_CHECK(read_buffer(store, luts[0], size) == lut);
+  auto changed = lut;
+  changed[1] = 2.f;
+  GPP_CHECK(read_buffer(store, luts[1], size) == changed);
+  GPP_CHECK(store.stats().resources == 2);
+
+  // Writing it back makes it shared again
+  const float one = 1.f;
+  store(gpu::static_upload{.handle = luts[1], .offset = 4, .size = sizeof(one), .data = (void*)&one});
+  GPP_CHECK(store.stats().resources == 1);
+  GPP_CHECK(store.stats().references == 2);
+
+  GPP_CHECK(throws<std::out_of_range>([&] {
+    store(gpu::static_upload{.handle = luts[0], .offset = size - 2, .size = 4, .data = (void*)&one});
+  }));
+
+  // Without a layout, nothing is assumed to be read-only
+  store.end();
+  auto unknown = store(gpu::static_allocation{.binding = 0, .size = size});
+  store(gpu::static_upload{.handle = unknown, .offset = 0, .size = size, .data = lut.data()});
+  GPP_CHECK(store.stats().references == 2);
+
+  for (auto handle : {luts[0], luts[1], results[0], results[1], unknown})
+    store(gpu::buffer_release{.handle = handle});
+  GPP_CHECK(store.stats().resources == 0);
+  GPP_CHECK(backend.releases == backend.allocations);
+}
+
+// Staging payloads are not copied, and flushes never share a staging buffer
+void test_upload_batching()
+{
+  gpu::cpu_backend cpu;
+  counting_backend<gpu::cpu_backend> backend{cpu};
+  {
+    gpu::upload_batcher batcher{backend, 2};
+    auto a = batcher(gpu::static_allocation{.binding = 0, .size = 16});
+    auto b = batcher(gpu::static_allocation{.binding = 0, .size = 16});
+
+    // Read when flushed, not when recorded
+    auto view = batcher(gpu::allocate_staging{.size = 16});
+    std::memset(view.data, 1, 16);
+    batcher(gpu::static_upload{.handle = a, .offset = 0, .size = 16, .data = view.data});
+    std::memset(view.data, 2, 16);
+    batcher.flush();
+    GPP_CHECK(cpu.get(a).data[15] == 2);
+
+    // Copied when recorded
+    std::array<char, 16> scratch;
+    scratch.fill(3);
+    batcher(gpu::static_upload{.handle = b, .offset = 0, .size = 16, .data = scratch.data()});
+    scratch.fill(4);
+    batcher.flush();
+    GPP_CHECK(cpu.get(b).data[15] == 3);
+
+    // Two flushes in each of the two frames in flight, then reuse
+    batcher.end_frame();
+    const int allocations = backend.allocations;
+    for (int frame = 0; frame < 4; frame++)
+    {
+      for (int flush = 0; flush < 2; flush++)
+      {
+        batcher(gpu::static_upload{.handle = a, .offset = 0, .size = 16, .data = scratch.data()});
+        batcher.flush();
+      }
+      batcher.end_frame();
+    }
+    GPP_CHECK(backend.allocations == allocations + 2);
+
+    batcher(gpu::buffer_release{.handle = a});
+    batcher(gpu::buffer_release{.handle = b});
+  }
+  GPP_CHECK(backend.releases == backend.allocations);
+}
+
+struct graphics_layout
+{
+  halp_flags(graphics);
+  struct
+  {
+    struct
+    {
+      halp_meta(name, "params");
+      halp_flags(std140, ubo);
+      static constexpr int binding() { return 0; }
+      gpu::uniform<"gain", float> gain;
+    } params;
+
+    gpu::sampler<"image", 2> image;
+
+    struct
+    {
+      halp_meta(name, "tweaks");
+      halp_flags(push_constant);
+      gpu::uniform<"offset", float> offset;
+    } tweaks;
+  } bindings;
+};
+
+struct filter_specialization
+{
+  gpu::local_size_constant<'x', 0, 8> local_size_x;
+  gpu::specialization_constant<"gain", float, 4, 1.5f> gain;
+  gpu::specialization_constant<"quality", std::int16_t, 7, 2> quality;
+  gpu::specialization_constant<"taps", int, 2, 3> taps;
+};
+
+// Entries are packed in declaration order ; set() only reports actual
+// changes, and a set of values seen before hits the cache
+void test_specialization()
+{
+  constexpr auto entries = gpu::specialization_entries<filter_specialization>();
+  static_assert(entries.size() == 4);
+  const gpu::specialization_entry expected[]{{0, 0, 4}, {4, 4, 4}, {7, 8, 2}, {2, 10, 4}};
+  for (int i = 0; i < 4; i++)
+  {
+    GPP_CHECK(entries[i].constant_id == expected[i].constant_id);
+    GPP_CHECK(entries[i].offset == expected[i].offset);
+    GPP_CHECK(entries[i].size == expected[i].size);
+  }
+
+  gpu::specialization_state state{filter_specialization{}};
+  GPP_CHECK(state.key().size() == 14);
+  float gain{};
+  std::memcpy(&gain, state.key().data() + 4, sizeof(gain));
+  GPP_CHECK(gain == 1.5f);
+
+  int specializations = 0;
+  gpu::pipeline_cache<int> cache;
+  auto pipeline = [&] { return cache.get(state.key(), [&] { return ++specializations; }); };
+  const int initial = pipeline();
+
+  const int taps = 5;
+  GPP_CHECK(state.set(2, &taps, sizeof(taps)));
+  GPP_CHECK(!state.set(2, &taps, sizeof(taps)));
+  const int tapped = pipeline();
+  GPP_CHECK(tapped != initial && specializations == 2);
+
+  const int original = 3;
+  GPP_CHECK(state.set(2, &original, sizeof(original)));
+  GPP_CHECK(pipeline() == initial);
+  GPP_CHECK(state.set(2, &taps, sizeof(taps)));
+  GPP_CHECK(pipeline() == tapped);
+  GPP_CHECK(specializations == 2 && cache.size() == 2);
+
+  // Neither a wrong size nor an unknown id changes anything
+  const std::string before{state.key()};
+  GPP_CHECK(throws<std::invalid_argument>([&] { state.set(7, &taps, sizeof(taps)); }));
+  GPP_CHECK(throws<std::invalid_argument>([&] { state.set(3, &taps, sizeof(taps)); }));
+  GPP_CHECK(state.key() == before);
+}
+
+// A node's names cannot clash with the default uniforms, which are global
+struct clashing_bindings
+{
+  struct
+  {
+    halp_meta(name, "params");
+    halp_flags(std140, ubo);
+    static constexpr int binding() { return 0; }
+    gpu::uniform<"gpp_time", float> time;
+  } params;
+};
+static_assert(gpu::clashes_with_default_uniforms<clashing_bindings>());
+static_assert(!gpu::clashes_with_default_uniforms<decltype(graphics_layout::bindings)>());
+
+// Graphics bindings are only in the stages which use them, and in both
+// rather than in none: a stage mask is never empty
+void test_descriptors()
+{
+  constexpr std::uint8_t both = gpu::vertex_stage | gpu::fragment_stage;
+  constexpr auto all = gpu::descriptors<graphics_layout>;
+  static_assert(all.size() == 4);
+  GPP_CHECK(all[2].kind == gpu::descriptor_kind::push_constant);
+  GPP_CHECK(all[3].binding == 3);
+  GPP_CHECK(all[3].name == "gpp_default_uniforms");
+  for (const auto& d : all)
+    GPP_CHECK(d.stages == both);
+
+  constexpr auto used = gpu::make_descriptors<graphics_layout>(
+      "gl_Position = vec4(gain * pos + offset, 1.);",
+      "color = texture(image, uv) * sin(gpp_time); // gain_x");
+  GPP_CHECK(used[0].stages == gpu::vertex_stage);
+  GPP_CHECK(used[1].stages == gpu::fragment_stage);
+  GPP_CHECK(used[2].stages == both);
+  GPP_CHECK(used[3].stages == gpu::fragment_stage);
+
+  // What the preamble writers go by
+  constexpr graphics_layout layout{};
+  static_assert(gpu::binding_stages("gain;", "", layout.bindings.params) == gpu::vertex_stage);
+  static_assert(gpu::binding_stages("", "", layout.bindings.image) == both);
+  static_assert(gpu::binding_stages("", "", layout.bindings.tweaks) == both);
+
+  const auto unused = gpu::make_descriptors<graphics_layout>("", "");
+  for (const auto& d : unused)
+    GPP_CHECK(d.stages == both);
+}
+
+struct packed_vertex
+{
+  gpp_attribute(0, position, float[3], position) pos;
+  gpp_attribute(1, color, std::uint8_t[4], color) col;
+  gpp_attribute(2, weights, float[5], weights) weights;
+  gpp_attribute(3, texcoord, float[2], texcoord) tex;
+};
+
+// The wide copies give the same bytes as attribute-by-attribute ones,
+// without touching anything past the sources
+void test_vertex_packer()
+{
+  using packer = gpu::vertex_packer<packed_vertex>;
+  static_assert(packer::stride == 12 + 4 + 20 + 8);
+
+  std::minstd_rand rng{7};
+  for (std::size_t count : {0, 1, 2, 3, 5, 8, 17, 100})
+  {
+    // Exactly sized, so that reading past them is caught by ASan
+    std::vector<std::vector<char>> attributes;
+    packer::sources src{};
+    for (int i = 0; i < packer::attributes; i++)
+    {
+      auto& a = attributes.emplace_back(count * packer::sizes[i]);
+      for (auto& c : a)
+        c = char(rng());
+      src[i] = a.data();
+    }
+
+    std::vector<char> interleaved(packer::interleaved_size(count));
+    packer::interleave(interleaved.data(), count, src);
+    std::vector<char> soa(packer::soa_size(count));
+    packer::soa(soa.data(), count, src);
+
+    bool same = true;
+    for (std::size_t v = 0; v < count; v++)
+    {
+      for (int i = 0; i < packer::attributes; i++)
+      {
+        const char* expected = attributes[i].data() + v * packer::sizes[i];
+        same &= std::memcmp(interleaved.data() + v * packer::stride + packer::offsets[i], expected, packer::sizes[i]) == 0;
+        same &= std::memcmp(soa.data() + packer::soa_offset(i, count) + v * packer::sizes[i], expected, packer::sizes[i]) == 0;
+      }
+    }
+    GPP_CHECK(same);
+  }
+}
+
+struct mesh_vertex
+{
+  gpp_attribute(0, position, float[3], position) pos;
+  gpp_attribute(1, texcoord, gpu::unorm16[2], texcoord) tex;
+};
+
+// Triangles as vertex ids, each rotated to start with its smallest id so
+// that the winding is kept, sorted: what a reordering must not change
+template <typename Id>
+std::vector<std::array<std::uint32_t, 3>> triangle_set(std::size_t index_count, Id&& id)
+{
+  std::vector<std::array<std::uint32_t, 3>> triangles;
+  for (std::size_t i = 0; i + 3 <= index_count; i += 3)
+  {
+    std::array<std::uint32_t, 3> t{id(i), id(i + 1), id(i + 2)};
+    std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+    triangles.push_back(t);
+  }
+  std::sort(triangles.begin(), triangles.end());
+  return triangles;
+}
+
+// Optimizing reorders triangles and vertices without changing the mesh,
+// and narrows indices only when every vertex fits in 16 bits
+void test_mesh_optimizer()
+{
+  // A grid with its triangles shuffled, and one vertex no triangle uses.
+  // The third position component is the vertex id, to follow vertices.
+  constexpr std::uint32_t n = 16;
+  constexpr std::size_t grid_vertices = (n + 1) * (n + 1);
+  std::vector<float> positions, texcoords;
+  for (std::size_t v = 0; v <= grid_vertices; v++)
+  {
+    positions.insert(positions.end(), {float(v % (n + 1)), float(v / (n + 1)), float(v)});
+    texcoords.insert(texcoords.end(), {float(v % (n + 1)) / n, float(v / (n + 1)) / n - 0.5f});
+  }
+  std::vector<std::uint32_t> indices;
+  for (std::uint32_t y = 0; y < n; y++)
+    for (std::uint32_t x = 0; x < n; x++)
+    {
+      const std::uint32_t i = y * (n + 1) + x;
+      indices.insert(indices.end(), {i, i + 1, i + n + 1, i + 1, i + n + 2, i + n + 1});
+    }
+  std::minstd_rand rng{43};
+  for (std::size_t t = indices.size() / 3 - 1; t > 0; t--)
+    std::swap_ranges(
+        indices.begin() + t * 3, indices.begin() + t * 3 + 3, indices.begin() + rng() % (t + 1) * 3);
+
+  const auto input = triangle_set(indices.size(), [&](std::size_t i) { return indices[i]; });
+
+  std::vector<std::uint32_t> reordered{indices};
+  gpu::mesh::optimize_vertex_cache(reordered.data(), reordered.size(), grid_vertices + 1);
+  GPP_CHECK(triangle_set(reordered.size(), [&](std::size_t i) { return reordered[i]; }) == input);
+  GPP_CHECK(gpu::mesh::acmr(reordered.data(), reordered.size(), 16)
+            < gpu::mesh::acmr(indices.data(), indices.size(), 16));
+
+  // Following the remap back through the vertex data gives the same triangles
+  gpu::mesh_optimizer<mesh_vertex> mesh;
+  mesh.optimize({positions.data(), texcoords.data()}, grid_vertices + 1, indices.data(), indices.size());
+  GPP_CHECK(mesh.vertex_count() == grid_vertices);
+  GPP_CHECK(mesh.index_type() == gpu::index_format::uint16);
+  GPP_CHECK(mesh.stats().acmr_after < mesh.stats().acmr_before);
+
+  using packer = gpu::vertex_packer<mesh_vertex>;
+  const auto vertices = static_cast<const char*>(mesh.vertex_data());
+  const auto narrow = static_cast<const std::uint16_t*>(mesh.index_data());
+  auto original_id = [&](std::size_t i)
+  {
+    float pos[3];
+    std::memcpy(pos, vertices + narrow[i] * packer::stride + packer::offsets[0], sizeof(pos));
+    return std::uint32_t(pos[2]);
+  };
+  GPP_CHECK(triangle_set(mesh.index_count(), original_id) == input);
+
+  bool same = true;
+  for (std::size_t v = 0; v < mesh.vertex_count(); v++)
+  {
+    float pos[3];
+    gpu::unorm16 tex[2];
+    std::memcpy(pos, vertices + v * packer::stride + packer::offsets[0], sizeof(pos));
+    std::memcpy(tex, vertices + v * packer::stride + packer::offsets[1], sizeof(tex));
+    const std::size_t id = std::size_t(pos[2]);
+    same &= pos[0] == positions[id * 3] && pos[1] == positions[id * 3 + 1];
+    same &= tex[0].value == gpu::mesh::encode<gpu::unorm16>(texcoords[id * 2]).value;
+    same &= tex[1].value == gpu::mesh::encode<gpu::unorm16>(texcoords[id * 2 + 1]).value;
+  }
+  GPP_CHECK(same);
+
+  // 16-bit indices up to exactly 65536 vertices, counting only used ones
+  auto index_type = [&](std::size_t vertex_count, std::size_t used, bool small = true)
+  {
+    std::vector<float> zeros(vertex_count * 3);
+    std::vector<std::uint32_t> wide((used + 2) / 3 * 3);
+    for (std::size_t i = 0; i < wide.size(); i++)
+      wide[i] = std::uint32_t(i % used);
+
+    gpu::mesh_optimizer<mesh_vertex> big;
+    big.optimize(
+        {zeros.data(), zeros.data()}, vertex_count, wide.data(), wide.size(),
+        {.reorder_triangles = false, .small_indices = small});
+    if (big.index_type() == gpu::index_format::uint16)
+    {
+      auto narrowed = static_cast<const std::uint16_t*>(big.index_data());
+      GPP_CHECK(std::equal(wide.begin(), wide.end(), narrowed));
+      GPP_CHECK(big.index_bytes() == int(wide.size() * 2));
+    }
+    return big.index_type();
+  };
+  GPP_CHECK(index_type(65536, 65536) == gpu::index_format::uint16);
+  GPP_CHECK(index_type(65537, 65536) == gpu::index_format::uint16);
+  GPP_CHECK(index_type(65537, 65537) == gpu::index_format::uint32);
+  GPP_CHECK(index_type(300, 300, false) == gpu::index_format::uint32);
+
+  // Quantization clamps to the range, and rounds to nearest
+  using gpu::mesh::encode;
+  GPP_CHECK(encode<gpu::snorm16>(2.f).value == 32767);
+  GPP_CHECK(encode<gpu::snorm16>(-2.f).value == -32767);
+  GPP_CHECK(encode<gpu::snorm16>(0.5f).value == 16384);
+  GPP_CHECK(encode<gpu::snorm16>(-0.5f).value == -16384);
+  GPP_CHECK(encode<gpu::snorm16>(1.f / 32767.f * 0.49f).value == 0);
+  GPP_CHECK(encode<gpu::unorm16>(-1.f).value == 0);
+  GPP_CHECK(encode<gpu::unorm16>(1.5f).value == 65535);
+  GPP_CHECK(encode<gpu::unorm16>(0.5f).value == 32768);
+  GPP_CHECK(encode<gpu::unorm16>(1.f / 65535.f * 0.51f).value == 1);
+  GPP_CHECK(encode<gpu::half>(1.f).bits == 0x3c00);
+  GPP_CHECK(encode<gpu::half>(1.f + 0x1p-11f).bits == 0x3c00);
+  GPP_CHECK(encode<gpu::half>(1.f + 3 * 0x1p-11f).bits == 0x3c02);
+  GPP_CHECK(encode<gpu::half>(-65520.f).bits == 0xfc00);
+}
+
+// A pass begun twice gives one sample, and both queries get recycled
+void test_pass_timings()
+{
+  gpu::cpu_backend backend;
+  gpu::pass_timings timings;
+  timings.begin(backend, 1);
+  timings.begin(backend, 1);
+  timings.end(backend, 1);
+  GPP_CHECK(timings.pending_queries() == 2);
+  timings.collect(backend);
+  GPP_CHECK(timings.pending_queries() == 0);
+
+  const auto report = timings.report();
+  GPP_CHECK(report.size() == 1 && report[0].samples == 1);
+
+  // Not ready until ended
+  auto a = backend(gpu::begin_query{});
+  GPP_CHECK(!backend(gpu::query_awaiter{.handle = a}).ready);
+  backend(gpu::end_query{.handle = a});
+  GPP_CHECK(backend(gpu::query_awaiter{.handle = a}).ready);
+}
+
+// Evicted textures come back through needs_update(), without input changes
+void test_memory_budget()
+{
+  gpu::cpu_backend cpu;
+  gpu::thread_pool pool{1};
+  cpu.workers = &pool;
+
+  // Room for a single 16x16 texture and its mips
+  gpu::memory_budget budget{cpu, 2000};
+  examples::GpuFilterExample a, b;
+
+  auto frame = [&](std::uint32_t id, examples::GpuFilterExample& node)
+  {
+    budget.begin(id);
+    if (gpu::update_required(node))
+      run_update(node, budget);
+    budget.end();
+    budget.end_frame();
+  };
+
+  frame(1, a);
+  GPP_CHECK(a.tex_handle && budget.evictions() == 0);
+
+  frame(2, b);
+  GPP_CHECK(!a.tex_handle && b.tex_handle);
+  GPP_CHECK(budget.evictions() == 1);
+  GPP_CHECK(budget.usage(1u) == 0 && budget.usage() <= budget.budget());
+
+  frame(1, a);
+  GPP_CHECK(a.tex_handle && !b.tex_handle);
+  GPP_CHECK(budget.evictions() == 2);
+  GPP_CHECK(budget.usage(2u) == 0 && budget.usage() <= budget.budget());
+
+  // Nothing to do once resident
+  GPP_CHECK(!gpu::update_required(a));
+  for (auto& promise : a.release())
+    gpu::execute<gpu::update_handle>(budget, promise.current_command);
+  GPP_CHECK(budget.usage() == 0);
+
+  // Made evictable after a resource used in this frame, an older one
+  // still comes first
+  gpu::memory_budget small{cpu, 250};
+  auto older = small(gpu::static_allocation{.binding = 0, .size = 100});
+  small.end_frame();
+  auto recent = small(gpu::static_allocation{.binding = 0, .size = 100});
+  small(gpu::set_residency{.buffer = &recent});
+  small(gpu::set_residency{.buffer = &older});
+
+  auto added = small(gpu::static_allocation{.binding = 0, .size = 100});
+  GPP_CHECK(!older && recent && small.evictions() == 1);
+  GPP_CHECK(small.usage() == 200);
+  small(gpu::buffer_release{.handle = recent});
+  small(gpu::buffer_release{.handle = added});
+}
+
+// CPU work which starts once "start" is set, sets "ran", and may fail
+gpu::co_update offloaded(
+    const std::atomic_bool& start, std::atomic_bool& ran, std::atomic_bool& resumed,
+    std::thread::id& worker, bool fail)
+{
+  auto work = [&]
+  {
+    while (!start)
+      std::this_thread::yield();
+    worker = std::this_thread::get_id();
+    ran = true;
+    if (fail)
+      throw std::runtime_error{"work failed"};
+  };
+  co_yield gpu::cpu_task{work};
+  resumed = true;
+}
+
+void test_cpu_tasks()
+{
+  gpu::cpu_backend backend;
+  const std::atomic_bool now{true};
+  std::thread::id worker_a, worker_b;
+
+  // finish() resumes whichever coroutine's work completes first: "a" only
+  // starts once "b" resumed
+  {
+    gpu::thread_pool pool{2};
+    std::atomic_bool ran_a{}, ran_b{}, resumed_a{}, resumed_b{};
+    gpu::update_runner runner{pool};
+    runner.run(offloaded(resumed_b, ran_a, resumed_a, worker_a, false));
+    runner.run(offloaded(now, ran_b, resumed_b, worker_b, false));
+    runner.finish(backend);
+    GPP_CHECK(resumed_a && resumed_b);
+  }
+
+  // A failure propagates, and the other work is waited for before its
+  // coroutine goes away
+  {
+    gpu::thread_pool pool{2};
+    std::atomic_bool ran_a{}, ran_b{}, resumed_a{}, resumed_b{};
+    bool failed = false;
+    try
+    {
+      gpu::update_runner runner{pool};
+      runner.run(offloaded(ran_b, ran_a, resumed_a, worker_a, false));
+      runner.run(offloaded(now, ran_b, resumed_b, worker_b, true));
+      runner.finish(backend);
+    }
+    catch (const std::runtime_error&)
+    {
+      failed = true;
+    }
+    GPP_CHECK(failed && !resumed_b && ran_a);
+  }
+
+  // The command queue keeps CPU work off the render thread
+  for (bool pooled : {false, true})
+  {
+    gpu::thread_pool pool{1};
+    gpu::update_channel channel;
+    std::atomic_bool ran{}, resumed{}, finished{};
+    worker_a = {};
+    std::jthread control{[&] {
+      gpu::update_producer producer{channel, pooled ? &pool : nullptr};
+      producer.run(offloaded(now, ran, resumed, worker_a, false));
+      while (producer.poll() > 0)
+        std::this_thread::yield();
+      finished = true;
+    }};
+    while (!finished)
+      channel.consume(backend);
+    control.join();
+    GPP_CHECK(resumed);
+    GPP_CHECK(worker_a != std::thread::id{} && worker_a != std::this_thread::get_id());
+  }
+}
+
+// Forwards to the CPU backend, remembering the compute example's result
+// buffer, which the host binds for dispatch_image()
+struct compute_host
+{
+  gpu::cpu_backend& cpu;
+  gpu::buffer_handle result{};
+
+  template <typename C>
+  typename C::return_type operator()(const C& command)
+  {
+    if constexpr (std::is_same_v<C, gpu::static_allocation>)
+    {
+      auto handle = cpu(command);
+      if (command.binding == 0)
+        result = handle;
+      return handle;
+    }
+    else
+    {
+      return cpu(command);
+    }
+  }
+};
+
+// What the compute example's shader does for a dispatch of x * y groups,
+// then the reduction passes
+struct average_kernel
+{
+  compute_host& host;
+  const int& downscale;
+
+  // Bound by the host when the node does not bind a tile
+  gpu::cpu_backend::texture* image{};
+  bool in_bounds{true};
+
+  void operator()(gpu::cpu_backend& backend, int x, int y, int z)
+  {
+    if (backend.bound_buffers.contains(1))
+      return reduction_kernel(backend, x, y, z);
+
+    auto& tex = backend.bound_textures.contains(1) ? *backend.bound_textures.at(1) : *image;
+    const std::span<char> out = backend.bound_buffers.contains(0)
+                                    ? backend.bound_buffers.at(0)
+                                    : std::span<char>{backend.get(host.result).data};
+    const int width = backend.push_constant<int>(0);
+    const int height = backend.push_constant<int>(4);
+    const int stride = x * 16;
+    const int rows = (height + downscale - 1) / downscale;
+    auto pixels = reinterpret_cast<const float*>(tex.data.data());
+
+    for (int cy = 0; cy < y * 16; cy++)
+    {
+      for (int cx = 0; cx < stride; cx++)
+      {
+        float color[4]{};
+        for (int i = 0; i < downscale; i++)
+          for (int j = 0; j < downscale; j++)
+          {
+            const int px = cx * downscale + i;
+            const int py = cy * downscale + j;
+            if (px < width && py < height)
+              for (int c = 0; c < 4; c++)
+                color[c] += pixels[(std::size_t(py) * tex.width + px) * 4 + c];
+          }
+
+        if (cy < rows)
+        {
+          const std::size_t offset = (std::size_t(cy) * stride + cx) * sizeof(color);
+          if (offset + sizeof(color) > out.size())
+            in_bounds = false;
+          else
+            std::memcpy(out.data() + offset, color, sizeof(color));
+        }
+      }
+    }
+  }
+};
+
+template <typename Pixel>
+std::array<double, 4> average(const std::vector<Pixel>& pixels, double scale)
+{
+  std::array<double, 4> sum{};
+  for (std::size_t i = 0; i < pixels.size(); i++)
+    sum[i % 4] += pixels[i] * scale;
+  for (auto& v : sum)
+    v /= pixels.size() / 4;
+  return sum;
+}
+
+bool close(const float (&value)[4], const std::array<double, 4>& expected)
+{
+  for (int c = 0; c < 4; c++)
+    if (std::abs(value[c] - expected[c]) > 1e-5)
+      return false;
+  return true;
+}
+
+// The compute example averages images whose sides are not multiples of
+// a workgroup, in one dispatch or streamed by tiles, for both downscales
+void test_compute_average()
+{
+  std::minstd_rand rng{47};
+  for (int downscale : {16, 8})
+  {
+    gpu::cpu_backend cpu;
+    compute_host host{cpu};
+    examples::GpuComputeExample node;
+    node.downscale = downscale;
+    average_kernel kernel{host, node.downscale};
+    cpu.kernel = std::ref(kernel);
+
+    // From the "Image" port
+    const int width = 300, height = 170;
+    std::vector<float> image(width * height * 4);
+    for (auto& v : image)
+      v = rng() / float(rng.max());
+    auto tex = cpu(gpu::texture_allocation{
+        .binding = 1, .width = width, .height = height, .format = gpu::texture_format::rgba32f});
+    cpu(gpu::texture_upload{.handle = tex, .offset = 0, .size = int(image.size() * sizeof(float)), .data = image.data()});
+    kernel.image = &cpu.get(tex);
+
+    node.inputs.width.value = width;
+    node.inputs.height.value = height;
+    node.controls.publish(node.inputs);
+    if (gpu::update_required(node))
+      run_update(node, host);
+    run_dispatch(node, host);
+    GPP_CHECK(close(node.outputs.color_out.value, average(image, 1.)));
+
+    // Streamed from host memory: 3 x 2 tiles, the last ones partial
+    std::vector<std::uint8_t> big(2500 * 1500 * 4);
+    for (auto& v : big)
+      v = rng();
+    node.source = {.data = big.data(), .width = 2500, .height = 1500};
+    run_update(node, host);
+    run_dispatch(node, host);
+    GPP_CHECK(close(node.outputs.color_out.value, average(big, 1. / 255.)));
+    GPP_CHECK(kernel.in_bounds);
+
+    for (auto& promise : node.release())
+      gpu::execute<gpu::update_handle>(host, promise.current_command);
+  }
+}
+
+// Push constants and buffer sizes come from the same snapshot of the
+// inputs: their default values until the host publishes others
+void test_compute_snapshot()
+{
+  gpu::cpu_backend cpu;
+  compute_host host{cpu};
+  examples::GpuComputeExample node;
+  average_kernel kernel{host, node.downscale};
+  cpu.kernel = std::ref(kernel);
+
+  const int side = node.inputs.width.value;
+  GPP_CHECK(side == 100 && node.inputs.height.value == side);
+  std::vector<float> image(side * side * 4);
+  std::minstd_rand rng{50};
+  for (auto& v : image)
+    v = rng() / float(rng.max());
+  auto tex = cpu(gpu::texture_allocation{
+      .binding = 1, .width = side, .height = side, .format = gpu::texture_format::rgba32f});
+  cpu(gpu::texture_upload{.handle = tex, .offset = 0, .size = int(image.size() * sizeof(float)), .data = image.data()});
+  kernel.image = &cpu.get(tex);
+
+  auto frame = [&]
+  {
+    if (gpu::update_required(node))
+      run_update(node, host);
+    run_dispatch(node, host);
+  };
+
+  frame();
+  GPP_CHECK(cpu.push_constant<int>(0) == side);
+  GPP_CHECK(close(node.outputs.color_out.value, average(image, 1.)));
+
+  // Not published yet: nothing changes
+  node.inputs.width.value = 40;
+  frame();
+  GPP_CHECK(cpu.push_constant<int>(0) == side);
+  GPP_CHECK(close(node.outputs.color_out.value, average(image, 1.)));
+
+  node.controls.publish(node.inputs);
+  frame();
+  GPP_CHECK(cpu.push_constant<int>(0) == 40);
+  std::vector<float> left;
+  for (int y = 0; y < side; y++)
+    left.insert(left.end(), image.begin() + y * side * 4, image.begin() + (y * side + 40) * 4);
+  GPP_CHECK(close(node.outputs.color_out.value, average(left, 1.)));
+  GPP_CHECK(kernel.in_bounds);
+
+  for (auto& promise : node.release())
+    gpu::execute<gpu::update_handle>(host, promise.current_command);
+}
+
+// The cores of a haloed grid tile the image exactly
+void test_tile_merge()
+{
+  const int width = 37, height = 23, bpp = 4;
+  std::vector<std::uint8_t> image(width * height * bpp);
+  std::minstd_rand rng{13};
+  for (auto& v : image)
+    v = rng();
+  const gpu::image_view view{.data = image.data(), .width = width, .height = height};
+
+  for (int halo : {0, 3})
+  {
+    const gpu::tile_grid grid{width, height, 8, halo};
+    GPP_CHECK(grid.size() == 5 * 3);
+    std::vector<std::uint8_t> merged(image.size());
+    bool sources_ok = true;
+    for (int i = 0; i < grid.size(); i++)
+    {
+      const auto t = grid[i];
+      sources_ok &= t.source_x == std::max(0, t.x - halo) && t.source_y == std::max(0, t.y - halo)
+                    && t.source_x + t.source_width == std::min(width, t.x + t.width + halo)
+                    && t.source_y + t.source_height == std::min(height, t.y + t.height + halo);
+
+      // What a pass would produce over the source rectangle: a copy of it
+      std::vector<std::uint8_t> output(t.source_width * t.source_height * bpp);
+      for (int row = 0; row < t.source_height; row++)
+        std::memcpy(
+            output.data() + row * t.source_width * bpp, view.pixel(t.source_x, t.source_y + row),
+            t.source_width * bpp);
+      gpu::merge_tile(merged.data(), width * bpp, t, output.data(), bpp);
+    }
+    GPP_CHECK(sources_ok);
+    GPP_CHECK(merged == image);
+  }
+}
+
+// A node whose inputs are written by another thread
+struct tracked_node
+{
+  struct uniforms
+  {
+    gpu::uniform<"gain", float> gain;
+    gpu::uniform<"offset", float> offset;
+  };
+
+  struct value_port
+  {
+    float value{1.f};
+  };
+
+  struct
+  {
+    gpu::uniform_control_port<value_port, &uniforms::gain> gain;
+    value_port other;
+  } inputs;
+
+  gpu::input_tracker<decltype(inputs)> input_changes;
+  gpu::uniform_snapshot<decltype(inputs), uniforms> controls;
+
+  int updates{};
+  float other{};
+
+  gpu::co_update update()
+  {
+    updates++;
+    other = controls.inputs().other.value;
+    co_return;
+  }
+};
+
+float uploaded_gain(tracked_node& node)
+{
+  float gain{};
+  std::memcpy(&gain, node.controls.uploads({}).front().data, sizeof(gain));
+  return gain;
+}
+
+// update_required() only sees what was published
+void test_input_snapshot()
+{
+  tracked_node node;
+  GPP_CHECK(gpu::update_required(node));
+  GPP_CHECK(uploaded_gain(node) == 1.f);
+  GPP_CHECK(!gpu::update_required(node));
+
+  node.inputs.gain.value = 2.f;
+  GPP_CHECK(!gpu::update_required(node));
+  GPP_CHECK(uploaded_gain(node) == 1.f);
+
+  node.controls.publish(node.inputs);
+  GPP_CHECK(gpu::update_required(node));
+  GPP_CHECK(node.input_changes.changed(node.controls.inputs().gain));
+  GPP_CHECK(!node.input_changes.changed(node.controls.inputs().other));
+  GPP_CHECK(uploaded_gain(node) == 2.f);
+  GPP_CHECK(!gpu::update_required(node));
+
+  // Every host path goes through update_required()
+  gpu::cpu_backend backend;
+  gpu::thread_pool pool{1};
+  gpu::update_runner runner{pool};
+  runner.run_update(node);
+  runner.finish(backend);
+  GPP_CHECK(node.updates == 0);
+
+  node.inputs.other.value = 3.f;
+  node.controls.publish(node.inputs);
+  runner.run_update(node);
+  runner.finish(backend);
+  GPP_CHECK(node.updates == 1);
+  GPP_CHECK(node.other == 3.f);
+}
+
+// A publication is never lost, whenever it lands
+void test_concurrent_publish()
+{
+  tracked_node node;
+  constexpr int last = 2000;
+  std::atomic_bool done{};
+  std::jthread writer{[&] {
+    auto inputs = node.inputs;
+    for (int i = 1; i <= last; i++)
+    {
+      inputs.other.value = float(i);
+      node.controls.publish(inputs);
+    }
+    done = true;
+  }};
+
+  float previous = 0.f;
+  bool ordered = true;
+  for (;;)
+  {
+    const bool finished = done;
+    if (gpu::update_required(node))
+      for (auto& promise : node.update())
+        (void)promise;
+    ordered = ordered && node.other >= previous;
+    previous = node.other;
+    if (finished)
+      break;
+  }
+
+  GPP_CHECK(ordered);
+  GPP_CHECK(node.other == float(last));
+}
+}
+
+// Takes "cost" of CPU time in each update()
+struct timed_node
+{
+  std::chrono::milliseconds cost{};
+  int runs{};
+
+  gpu::co_update update()
+  {
+    const auto end = std::chrono::steady_clock::now() + cost;
+    while (std::chrono::steady_clock::now() < end)
+      ;
+    runs++;
+    co_return;
+  }
+};
+
+// Over budget, low priority nodes wait, but no longer than their
+// max_update_interval ; nodes never measured run regardless
+void test_node_scheduler()
+{
+  using namespace std::chrono_literals;
+  gpu::cpu_backend cpu;
+
+  // Even without any budget, a first run to measure the nodes
+  {
+    timed_node a{1ms}, b{1ms};
+    gpu::node_scheduler<gpu::cpu_backend> scheduler{0ns};
+    scheduler.add(a);
+    scheduler.add(b, {.priority = gpu::priority::low});
+    scheduler.run_frame(cpu);
+    GPP_CHECK(a.runs == 1 && b.runs == 1);
+    GPP_CHECK(scheduler.last_frame().ran == 2);
+    scheduler.run_frame(cpu);
+    GPP_CHECK(a.runs == 1 && b.runs == 1);
+    GPP_CHECK(scheduler.last_frame().skipped == 2);
+  }
+
+  // Room for one of the two nodes: the one of normal priority gets it
+  {
+    timed_node normal{10ms}, low{10ms};
+    gpu::node_scheduler<gpu::cpu_backend> scheduler{15ms};
+    const int low_id = scheduler.add(low, {.priority = gpu::priority::low});
+    scheduler.add(normal);
+    for (int frame = 0; frame < 3; frame++)
+      scheduler.run_frame(cpu);
+    GPP_CHECK(normal.runs == 3);
+    GPP_CHECK(low.runs == 1);
+    GPP_CHECK(scheduler.stats(low_id).skips == 2 && scheduler.stats(low_id).staleness == 2);
+  }
+
+  // The low priority node alone is over budget, but has to run every third frame
+  {
+    timed_node normal{10ms}, low{20ms};
+    gpu::node_scheduler<gpu::cpu_backend> scheduler{15ms};
+    scheduler.add(normal);
+    const int low_id = scheduler.add(low, {.priority = gpu::priority::low, .max_update_interval = 3});
+    std::string ran;
+    for (int frame = 0; frame < 7; frame++)
+    {
+      const int before = low.runs;
+      scheduler.run_frame(cpu);
+      ran += low.runs > before ? 'L' : '.';
+      GPP_CHECK(scheduler.stats(low_id).staleness < 3);
+    }
+    GPP_CHECK(ran == "L..L..L");
+  }
+}
+
+int main()
+{
+  test_reduction();
+  test_texture_copies();
+  test_conversion_kernels();
+  test_spsc_queue();
+  test_capture_round_trip();
+  test_readback_recycling();
+  test_mipmaps();
+  test_content_store();
+  test_upload_batching();
+  test_specialization();
+  test_descriptors();
+  test_vertex_packer();
+  test_mesh_optimizer();
+  test_pass_timings();
+  test_memory_budget();
+  test_cpu_tasks();
+  test_compute_average();
+  test_compute_snapshot();
+  test_tile_merge();
+  test_input_snapshot();
+  test_concurrent_publish();
+  test_node_scheduler();
+
+  if (failures > 0)
+    std::fprintf(stderr, "%d check(s) failed\n", failures);
+  return failures > 0;
+}
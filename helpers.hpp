@@ -1,11 +1,16 @@
 #pragma once
+#include "reflection.hpp"
 #include <halp/static_string.hpp>
-#include <boost/pfr/core.hpp>
+#include <array>
+#include <cstdint>
 #include <coroutine>
 #include <cstdlib>
+#include <memory>
+#include <optional>
 #include <variant>
 #include <vector>
 #include <string_view>
+#include <type_traits>
 
 // Quick helper macro
 #define halp_flag(flag) enum { flag }
@@ -349,6 +354,149 @@ enum class binding_stage
   fragment
 };
 
+enum class texture_format
+{
+  r8,
+  rg8,
+  rgba8,
+  bgra8,
+  r16f,
+  rg16f,
+  rgba16f,
+  r32f,
+  rg32f,
+  rgba32f,
+
+  // Only valid as the format of uploaded data, expanded to rgba on upload
+  rgb8
+};
+
+constexpr int channels(texture_format fmt) noexcept
+{
+  switch (fmt)
+  {
+    case texture_format::r8:
+    case texture_format::r16f:
+    case texture_format::r32f:
+      return 1;
+    case texture_format::rg8:
+    case texture_format::rg16f:
+    case texture_format::rg32f:
+      return 2;
+    case texture_format::rgb8:
+      return 3;
+    default:
+      return 4;
+  }
+}
+
+// Size of a single channel
+constexpr int channel_size(texture_format fmt) noexcept
+{
+  switch (fmt)
+  {
+    case texture_format::r16f:
+    case texture_format::rg16f:
+    case texture_format::rgba16f:
+      return 2;
+    case texture_format::r32f:
+    case texture_format::rg32f:
+    case texture_format::rgba32f:
+      return 4;
+    default:
+      return 1;
+  }
+}
+
+constexpr int bytes_per_pixel(texture_format fmt) noexcept
+{
+  return channels(fmt) * channel_size(fmt);
+}
+
+constexpr int texture_bytes(texture_format fmt, int width, int height) noexcept
+{
+  return bytes_per_pixel(fmt) * width * height;
+}
+
+// As used in image layout qualifiers
+constexpr std::string_view format_name(texture_format fmt) noexcept
+{
+  switch (fmt)
+  {
+    case texture_format::r8: return "r8";
+    case texture_format::rg8: return "rg8";
+    case texture_format::rgba8: return "rgba8";
+    case texture_format::r16f: return "r16f";
+    case texture_format::rg16f: return "rg16f";
+    case texture_format::rgba16f: return "rgba16f";
+    case texture_format::r32f: return "r32f";
+    case texture_format::rg32f: return "rg32f";
+    case texture_format::rgba32f: return "rgba32f";
+    default: return "";
+  }
+}
+
+// Number of levels of a full mip chain, down to 1x1
+constexpr int mip_level_count(int width, int height) noexcept
+{
+  int levels = 1;
+  while (width > 1 || height > 1)
+  {
+    width /= 2;
+    height /= 2;
+    levels++;
+  }
+  return levels;
+}
+
+static_assert(mip_level_count(16, 16) == 5);
+static_assert(mip_level_count(16, 5) == 5);
+static_assert(texture_bytes(texture_format::rgba8, 16, 16) == 16 * 16 * 4);
+static_assert(texture_bytes(texture_format::rgba16f, 2, 2) == 2 * 2 * 8);
+
+// Quantized vertex attribute components, e.g. "gpu::half data[2]":
+// the vertex fetch converts them back to floats, so shaders still see vecN.
+struct half { std::uint16_t bits; };
+struct snorm16 { std::int16_t value; }; // [-1, 1]
+struct unorm16 { std::uint16_t value; }; // [0, 1]
+
+enum class attribute_component : std::uint8_t
+{
+  float32,
+  int32,
+  float16,
+  snorm16,
+  unorm16
+};
+
+template <typename T>
+constexpr attribute_component component_of() noexcept
+{
+  using C = std::remove_cvref_t<std::remove_all_extents_t<T>>;
+  if constexpr (std::is_same_v<C, half>)
+    return attribute_component::float16;
+  else if constexpr (std::is_same_v<C, snorm16>)
+    return attribute_component::snorm16;
+  else if constexpr (std::is_same_v<C, unorm16>)
+    return attribute_component::unorm16;
+  else if constexpr (std::is_integral_v<C>)
+    return attribute_component::int32;
+  else
+    return attribute_component::float32;
+}
+
+template <typename T>
+constexpr int component_count() noexcept
+{
+  return std::is_array_v<T> ? int(std::extent_v<T>) : 1;
+}
+
+enum class index_format : std::uint8_t
+{
+  uint16,
+  uint32
+};
+
 enum class default_attributes
 {
   position,
@@ -357,7 +505,6 @@ enum class default_attributes
   texcoord,
   color
 };
-/*
 enum class default_uniforms
 {
   // Render-level default uniforms
@@ -379,11 +526,6 @@ enum class default_uniforms
 
 
 
-
-*/
-
-
-
 struct buffer_handle_t;
 using buffer_handle = buffer_handle_t*;
 struct texture_handle_t;
@@ -391,6 +533,9 @@ using texture_handle = texture_handle_t*;
 struct sampler_handle_t;
 using sampler_handle = sampler_handle_t*;
 
+// CPU memory handed out by the backend for the current frame
+struct staging_view { void* data; int size; };
+
 // Define our commands
 struct static_allocation
 {
@@ -410,6 +555,26 @@ struct static_upload
   void* data;
 };
 
+// Created with its content, which never changes afterwards
+struct immutable_allocation
+{
+  enum { allocation, immutable, storage };
+  using return_type = buffer_handle;
+  int binding;
+  int size;
+  void* data;
+};
+
+// Scratch memory to write upload payloads into, instead of keeping them
+// in the node: it stays valid until the frame has been submitted.
+struct allocate_staging
+{
+  enum { allocation, staging };
+  using return_type = staging_view;
+  int size;
+  int align{16};
+};
+
 struct dynamic_vertex_allocation
 {
   enum { allocation, dynamic, vertex };
@@ -433,6 +598,7 @@ struct dynamic_index_allocation
   using return_type = buffer_handle;
   int binding;
   int size;
+  index_format format{index_format::uint32};
 };
 struct dynamic_index_upload
 {
@@ -473,8 +639,21 @@ struct texture_allocation
   int binding;
   int width;
   int height;
+  int array_layers{1};
+  texture_format format{texture_format::rgba8};
+
+  // 0 means the full chain, see mip_level_count
+  int mip_levels{1};
 };
 
+// Without a region (width and height left to 0), "size" bytes of "data"
+// are copied at "offset" in the first layer.
+// With a region, only the x, y, width, height rectangle of the given mip level
+// and layer is updated ; rows are row_pitch bytes apart in "data"
+// (0 meaning tightly packed).
+// If data_format is set and differs from the texture's format, the data gets
+// converted on upload (see texture_conversion.hpp), and optionally
+// premultiplied by its alpha: "size" and "row_pitch" are in source bytes.
 struct texture_upload
 {
   enum { upload, texture };
@@ -483,6 +662,25 @@ struct texture_upload
   int offset;
   int size;
   void* data;
+
+  int x{}, y{};
+  int width{}, height{};
+  int mip_level{};
+  int array_layer{};
+  int row_pitch{};
+
+  std::optional<texture_format> data_format{};
+  bool premultiply{};
+};
+
+
+
+// Fills the mip levels of a texture from its first level
+struct generate_mips
+{
+  enum { mipmaps, texture };
+  using return_type = void;
+  texture_handle handle;
 };
 
 
@@ -551,7 +749,116 @@ struct compute_dispatch
   int x, y, z;
 };
 
+// Same as compute_dispatch, but the group counts are three uint32 read
+// on the device at "offset" in a buffer, e.g. written by a previous pass.
+struct compute_dispatch_indirect
+{
+  enum { compute, dispatch, indirect };
+  using return_type = void;
+  buffer_handle handle;
+  int offset;
+};
+
+// Binds a range of a storage buffer for the next dispatches.
+// The range is what the .length() of a runtime-sized array sees in the shader.
+struct bind_buffer
+{
+  enum { compute, bind, buffer };
+  using return_type = void;
+  int binding;
+  buffer_handle handle;
+  int offset;
+  int size;
+};
 
+// Binds a texture to an image binding for the next dispatches, e.g. to
+// alternate between the tiles of a tiled pipeline
+struct bind_texture
+{
+  enum { compute, bind, texture };
+  using return_type = void;
+  int binding;
+  texture_handle handle;
+};
+
+// Sets "size" bytes of the layout's push_constant block at "offset",
+// recorded straight in the command stream: no buffer to allocate or bind.
+// In dispatch(), they are used by the dispatches which follow ; in update(),
+// by the draws of the node during this frame. Like uploads, "data" may be
+// reused as soon as the command returns.
+struct set_push_constants
+{
+  enum { push_constants };
+  using return_type = void;
+  int offset;
+  int size;
+  void* data;
+};
+
+// What every device accepts for a whole push_constant block
+inline constexpr int max_push_constants_size = 128;
+
+// Changes the value of a specialization constant of the pipeline.
+// The shader is not compiled again: the backend looks up, or creates,
+// the matching specialization of the pipeline for the next pass.
+struct specialize
+{
+  enum { pipeline, specialization };
+  using return_type = void;
+  int constant_id;
+  int size;
+  void* data;
+};
+
+
+// Copies which stay on the device
+struct copy_buffer
+{
+  enum { copy, buffer_to_buffer };
+  using return_type = void;
+  buffer_handle src;
+  int src_offset;
+  buffer_handle dst;
+  int dst_offset;
+  int size;
+};
+
+// Copies between a buffer and a rectangle of a texture's mip level and
+// layer, with tightly packed rows in the buffer: "size" bytes, which must be
+// exactly what the rectangle holds.
+// Without a region (width and height left to 0), the whole level.
+struct copy_texture_to_buffer
+{
+  enum { copy, texture_to_buffer };
+  using return_type = void;
+  texture_handle src;
+  buffer_handle dst;
+  int dst_offset;
+  int size;
+
+  int x{}, y{};
+  int width{}, height{};
+  int mip_level{};
+  int array_layer{};
+};
+
+struct copy_buffer_to_texture
+{
+  enum { copy, buffer_to_texture };
+  using return_type = void;
+  buffer_handle src;
+  int src_offset;
+  texture_handle dst;
+  int size;
+
+  int x{}, y{};
+  int width{}, height{};
+  int mip_level{};
+  int array_layer{};
+};
+
+
+// What an awaited readback holds: valid until the next readback request
 struct buffer_view { const char* data; std::size_t size; };
 struct texture_view { const char* data; std::size_t size; };
 
@@ -579,26 +886,139 @@ struct readback_buffer
   int offset;
   int size;
 };
+// Without a region, reads back the whole first mip level of the first layer.
+// Region readbacks are tightly packed.
 struct readback_texture
 {
   enum { readback, request, texture };
   using return_type = texture_awaiter;
   texture_handle handle;
+
+  int x{}, y{};
+  int width{}, height{};
+  int mip_level{};
+  int array_layer{};
+};
+
+// Sums "count" vec4 elements of a storage buffer on the device,
+// see gpu::reduction. Only the final value gets read back.
+struct reduce_buffer
+{
+  enum { compute, reduce, buffer };
+  using return_type = buffer_awaiter;
+  buffer_handle handle;
+  int count;
 };
 
 
+// GPU timings. Queries are resolved asynchronously, like readbacks:
+// awaiting one never blocks, the result says whether it is available yet.
+// A query is recycled once its result has been returned ready.
+struct query_handle_t;
+using query_handle = query_handle_t*;
+
+struct query_result
+{
+  bool ready;
+  // Timestamps: device time ; begin / end queries: time between the two
+  std::uint64_t nanoseconds;
+};
+
+struct query_awaiter {
+    enum { query, await };
+    using return_type = query_result;
+    query_handle handle;
+};
+
+// Time at which every command before this one has completed
+struct write_timestamp
+{
+  enum { query, timestamp };
+  using return_type = query_handle;
+};
+
+// Measures the time taken by the commands between begin and end
+struct begin_query
+{
+  enum { query, begin };
+  using return_type = query_handle;
+};
+struct end_query
+{
+  enum { query, end };
+  using return_type = void;
+  query_handle handle;
+};
+
+// Device memory residency, see gpu::memory_budget
+enum class residency : std::uint8_t
+{
+  // Never evicted
+  resident,
+  // May be released under memory pressure: the handle the node keeps is
+  // then set to null, and the node allocates the resource again
+  evictable
+};
+
+// Gives the address of the node's handle member, so that it can be reset
+struct set_residency
+{
+  enum { budget, residency };
+  using return_type = void;
+  buffer_handle* buffer{};
+  texture_handle* texture{};
+  gpu::residency policy{gpu::residency::evictable};
+};
+
+// CPU-side work, e.g. preparing upload data, to run away from the render
+// thread: the coroutine resumes once it has completed, and the host goes on
+// with the other nodes meanwhile (see gpu::interleaved_runner).
+// Hosts without worker threads run it in place.
+//
+//   co_yield gpu::cpu_task{[&] { fill(pixels); }};
+//
+// Only a reference to the callable is kept: it lives in the coroutine
+// frame until the coroutine resumes, that is after the work has completed.
+struct cpu_task
+{
+  enum { cpu, task };
+  using return_type = void;
+
+  cpu_task() = default;
+
+  template <typename F>
+    requires(!std::is_same_v<std::remove_cvref_t<F>, cpu_task> && std::is_invocable_v<F&>)
+  explicit cpu_task(F&& work) noexcept
+      : context{(void*)std::addressof(work)}
+      , run{[](void* f) { (*static_cast<std::remove_reference_t<F>*>(f))(); }}
+  {
+  }
+
+  void operator()() const { run(context); }
+
+  void* context{};
+  void (*run)(void*){};
+};
 
 // Define what the update() can do
 using update_action = std::variant<
-  static_allocation, static_upload,
+  static_allocation, static_upload, immutable_allocation,
+  allocate_staging,
   dynamic_vertex_allocation, dynamic_vertex_upload, buffer_release,
   dynamic_index_allocation, dynamic_index_upload,
   dynamic_ubo_allocation, dynamic_ubo_upload, ubo_release,
   sampler_allocation, sampler_release,
   texture_allocation, texture_upload, texture_release,
-  get_ubo_handle
+  generate_mips,
+  get_ubo_handle,
+  set_push_constants,
+  specialize,
+  copy_buffer, copy_texture_to_buffer, copy_buffer_to_texture,
+  write_timestamp, begin_query, end_query, query_awaiter,
+  set_residency,
+  cpu_task
 >;
-using update_handle = std::variant<std::monostate, buffer_handle, texture_handle, sampler_handle>;
+using update_handle = std::variant<std::monostate, buffer_handle, texture_handle, sampler_handle, staging_view, query_handle, query_result>;
 using co_update = gpu::generator<update_action, update_handle>;
 
 
@@ -612,18 +1032,27 @@ using release_action = std::variant<
 using co_release = gpu::generator<release_action, void>;
 
 
-// Define what the dispatch(), for compute, can do
+// Define what the dispatch(), for compute, can do.
+// Uploads are allowed in between passes, to stream data (see tiling.hpp).
 
 using dispatch_action = std::variant<
   begin_compute_pass, end_compute_pass
-, compute_dispatch
+, compute_dispatch, compute_dispatch_indirect
+, bind_buffer, bind_texture, set_push_constants, specialize
+, texture_upload, dynamic_ubo_upload
+, copy_buffer, copy_texture_to_buffer, copy_buffer_to_texture
+, generate_mips
 , readback_buffer, readback_texture
+, reduce_buffer
 , buffer_awaiter, texture_awaiter
+, write_timestamp, begin_query, end_query, query_awaiter
+, cpu_task
 >;
 using dispatch_handle = std::variant<
   std::monostate
 , buffer_awaiter, texture_awaiter
 , buffer_view, texture_view
+, query_handle, query_result
 >;
 using co_dispatch = gpu::generator<dispatch_action, dispatch_handle>;
 
@@ -636,46 +1065,155 @@ consteval int binding()
 {
   return T::binding();
 }
+// Where a member of "field_size" bytes goes after "sz" bytes of a std140 block
+constexpr int std140_align(int sz, int field_size)
+{
+  switch (field_size)
+  {
+    case 8:
+      return (sz + 7) / 8 * 8;
+    case 12:
+    case 16:
+    case 64:
+      return (sz + 15) / 16 * 16;
+    default:
+      return sz;
+  }
+}
+
+// std140 offset of each member of a block
 template <typename T>
-consteval int std140_size()
+consteval auto std140_offsets()
 {
+  constexpr int field_count = reflect::field_count<T>;
+  std::array<int, field_count> offsets{};
   int sz = 0;
-  constexpr int field_count = boost::pfr::tuple_size_v<T>;
+  int i = 0;
   auto func = [&](auto field)
   {
-    switch (sizeof(field.value))
+    constexpr int field_size = sizeof(field.value);
+    switch (field_size)
     {
       case 4:
-        sz += 4;
-        break;
       case 8:
-        if (sz % 8 != 0)
-          sz += 4;
-        sz += 8;
-        break;
       case 12:
-        while (sz % 16 != 0)
-          sz += 4;
-        sz += 12;
-        break;
       case 16:
-        while (sz % 16 != 0)
-          sz += 4;
-        sz += 16;
+      case 64:
+        sz = std140_align(sz, field_size);
+        offsets[i] = sz;
+        sz += field_size;
+        break;
+      default:
+        offsets[i] = sz;
         break;
     }
+    i++;
   };
 
+  constexpr T t{};
+  reflect::for_each_member(t, func);
+  return offsets;
+}
+
+template <typename T>
+consteval int std140_size()
+{
+  constexpr int field_count = reflect::field_count<T>;
   if constexpr (field_count > 0)
   {
-    [&func]<typename K, K... Index>(std::integer_sequence<K, Index...>)
+    constexpr auto offsets = std140_offsets<T>();
+    constexpr int last_size
+        = sizeof(reflect::member_t<field_count - 1, T>::value);
+    switch (last_size)
     {
-      constexpr T t{};
-      (func(boost::pfr::get<Index, T>(t)), ...);
+      case 4:
+      case 8:
+      case 12:
+      case 16:
+      case 64:
+        return offsets.back() + last_size;
+      default:
+        return offsets.back();
     }
-    (std::make_index_sequence<field_count>{});
   }
-  return sz;
+  return 0;
+}
+
+template <typename>
+struct member_pointer_class;
+
+template <typename C, typename M>
+struct member_pointer_class<M C::*>
+{
+  using type = C;
+};
+
+// Index of the member pointed to by e.g. &custom_ubo::slider,
+// in declaration order
+template <auto Member>
+consteval int field_index()
+{
+  using T = typename member_pointer_class<decltype(Member)>::type;
+  T t{};
+  int index = -1;
+  int i = 0;
+  reflect::for_each_member(
+      t,
+      [&](const auto& field)
+      {
+        if (static_cast<const void*>(&field) == static_cast<const void*>(&(t.*Member)))
+          index = i;
+        i++;
+      });
+  return index;
+}
+
+// First binding not used by any member of a layout's bindings:
+// this is where the per-frame default uniforms go for this layout.
+template <typename T>
+consteval int first_free_binding()
+{
+  int bnd = 0;
+  auto func = [&]<typename F>(const F&)
+  {
+    if constexpr (requires { F::binding(); })
+    {
+      if (F::binding() >= bnd)
+        bnd = F::binding() + 1;
+    }
+  };
+
+  constexpr T t{};
+  reflect::for_each_member(t, func);
+  return bnd;
+}
+
+// Runs a command on a backend and wraps its result in the feedback type
+// expected by the coroutine, e.g. gpu::update_handle.
+// Backends only have to return the command's return_type.
+template <typename Feedback, typename Backend, typename Command>
+Feedback execute(Backend& backend, Command& command)
+{
+  return std::visit(
+      [&]<typename C>(C& cmd) -> Feedback
+      {
+        if constexpr (requires { C::cpu; C::task; })
+        {
+          // Not a GPU command: backends never see it
+          cmd();
+          return {};
+        }
+        else if constexpr (std::is_void_v<typename C::return_type>)
+        {
+          backend(cmd);
+          return {};
+        }
+        else
+        {
+          return backend(cmd);
+        }
+      },
+      command);
 }
 }
 
@@ -744,6 +1282,131 @@ namespace gpu
     T value;
   };
 
+  // Specialization constants: layout(constant_id = id) const T name = init;
+  // They go in the "specialization" struct of a layout.
+  template<halp::static_string lit, typename T, int id, T init = T{}>
+  struct specialization_constant {
+    static constexpr std::string_view name() { return lit.value; }
+    halp_flag(specialization);
+    static constexpr int constant_id() { return id; }
+    T value = init;
+  };
+
+  // Compute workgroup size given through specialization constants:
+  // layout(local_size_x_id = id) in;
+  template<char axis, int id, int init>
+  struct local_size_constant {
+    static constexpr char axis_name() { return axis; }
+    halp_flags(specialization, local_size);
+    static constexpr int constant_id() { return id; }
+    int value = init;
+  };
+
+  // The per-frame values listed in gpu::default_uniforms.
+  // The host owns a single instance of this UBO, uploads it once per frame,
+  // and it gets declared in a node's preamble only when its shader source
+  // references one of the members.
+  // The block has no instance name, so its members are global names in
+  // GLSL: they are prefixed (gpp_time, gpp_mouse...) to stay clear of the
+  // node's own.
+  // Members are ordered so that the C++ layout matches std140 exactly.
+  struct default_uniforms_ubo {
+    halp_meta(name, "gpp_default_uniforms");
+    halp_flags(std140, ubo);
+
+    uniform<"gpp_clip_space_matrix", float[16]> clip_space_matrix;
+    uniform<"gpp_date", float[4]> date;
+    uniform<"gpp_mouse", float[4]> mouse;
+    uniform<"gpp_channel_time", float[4]> channel_time;
+    uniform<"gpp_texcoord_adjust", float[2]> texcoord_adjust;
+    uniform<"gpp_render_size", float[2]> render_size;
+    uniform<"gpp_time", float> time;
+    uniform<"gpp_time_delta", float> time_delta;
+    uniform<"gpp_progress", float> progress;
+    uniform<"gpp_pass_index", int> pass_index;
+    uniform<"gpp_frame_index", int> frame_index;
+    uniform<"gpp_sample_rate", float> sample_rate;
+  };
+
+  static_assert(sizeof(default_uniforms_ubo) == std140_size<default_uniforms_ubo>());
+
+  // Whether a name declared by a layout's bindings, or by the members of
+  // its blocks, is also the name of a default uniform
+  template<typename Bindings>
+  consteval bool clashes_with_default_uniforms()
+  {
+    bool clash = false;
+    auto check = [&](std::string_view name) {
+      constexpr default_uniforms_ubo ubo{};
+      reflect::for_each_member(ubo, [&](const auto& member) {
+        clash |= member.name() == name;
+      });
+    };
+
+    constexpr Bindings bindings{};
+    reflect::for_each_member(bindings, [&]<typename B>(const B& binding) {
+      if constexpr (requires { B::name(); })
+        check(B::name());
+      if constexpr (requires { B::ubo; } || requires { B::buffer; } || requires { B::push_constant; })
+      {
+        reflect::for_each_member(binding, [&]<typename M>(const M&) {
+          if constexpr (requires { M::name(); })
+            check(M::name());
+        });
+      }
+    });
+    return clash;
+  }
+
+  // Where the default uniforms are bound for a given layout
+  template<typename Layout>
+  consteval int default_uniforms_binding()
+  {
+    static_assert(
+        !clashes_with_default_uniforms<decltype(Layout::bindings)>(),
+        "a binding or block member has the name of a default uniform");
+    return first_free_binding<decltype(Layout::bindings)>();
+  }
+
+  // Whether a GLSL identifier is used in a shader source
+  constexpr bool references(std::string_view source, std::string_view identifier)
+  {
+    auto is_identifier = [](char c) {
+      return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    };
+    for (auto pos = source.find(identifier); pos != source.npos;
+         pos = source.find(identifier, pos + 1))
+    {
+      const auto end = pos + identifier.size();
+      if ((pos == 0 || !is_identifier(source[pos - 1]))
+          && (end == source.size() || !is_identifier(source[end])))
+        return true;
+    }
+    return false;
+  }
+
+  // Whether a shader source uses a block: through any of its members,
+  // as GLSL blocks without an instance name expose them directly
+  template<typename Block>
+  constexpr bool references_block(std::string_view source, const Block& block)
+  {
+    bool used = false;
+    reflect::for_each_member(block, [&](const auto& member) {
+      used |= references(source, member.name());
+    });
+    return used;
+  }
+
+  // How a node's update() and dispatch() get scheduled when frames are over
+  // budget, see gpu::node_scheduler. Nodes declare e.g.:
+  //   halp_meta(update_priority, gpu::priority::low)
+  //   halp_meta(max_update_interval, 4) // run at least every 4th frame
+  enum class priority : std::uint8_t
+  {
+    low,
+    normal,
+    high
+  };
 
   // Those are to be used as the object ports
   template<halp::static_string lit, auto T>
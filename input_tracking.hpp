@@ -0,0 +1,159 @@
+#pragma once
+#include "helpers.hpp"
+#include <boost/pfr/core.hpp>
+
+#include <bitset>
+#include <cstring>
+#include <tuple>
+#include <utility>
+
+namespace gpu
+{
+// Last known value of a port.
+// Ports whose value cannot be compared are reported as changed every frame.
+template <typename Port>
+struct port_snapshot
+{
+  bool update(const Port&) noexcept { return true; }
+};
+
+// Plain values (floats, ints, arrays of them...) are compared bytewise,
+// which also keeps NaNs from looking changed on every frame
+template <typename Port>
+  requires requires(const Port& p) { p.value; }
+           && std::is_trivially_copyable_v<std::remove_cvref_t<decltype(std::declval<const Port&>().value)>>
+struct port_snapshot<Port>
+{
+  std::remove_cvref_t<decltype(std::declval<const Port&>().value)> value;
+
+  bool update(const Port& port) noexcept
+  {
+    if (std::memcmp(&value, &port.value, sizeof(value)) == 0)
+      return false;
+    std::memcpy(&value, &port.value, sizeof(value));
+    return true;
+  }
+};
+
+// Other values need to be copyable and comparable
+template <typename Port>
+  requires requires(const Port& p) { p.value; }
+           && (!std::is_trivially_copyable_v<std::remove_cvref_t<decltype(std::declval<const Port&>().value)>>)
+           && std::equality_comparable<std::remove_cvref_t<decltype(std::declval<const Port&>().value)>>
+           && std::is_copy_assignable_v<std::remove_cvref_t<decltype(std::declval<const Port&>().value)>>
+struct port_snapshot<Port>
+{
+  std::remove_cvref_t<decltype(std::declval<const Port&>().value)> value;
+
+  bool update(const Port& port)
+  {
+    if (value == port.value)
+      return false;
+    value = port.value;
+    return true;
+  }
+};
+
+// Remembers the values of an inputs struct from one frame to the next,
+// to tell which ports changed.
+//
+// A node opts in by declaring one after its inputs:
+//
+//   gpu::input_tracker<decltype(inputs)> input_changes;
+//
+// The host then only runs update() when a port changed since the previous
+// frame, or when the node asks for it through a `bool needs_update()` member
+// (e.g. for animations). In update(), input_changes.changed(inputs.foo)
+// tells whether a given port is among the ones which changed.
+//
+// When the node also has a gpu::uniform_snapshot named `controls`, its
+// inputs are owned by the thread publishing them: the tracker compares the
+// published snapshot instead, and update() reads controls.inputs().
+template <typename Inputs>
+class input_tracker
+{
+public:
+  static constexpr int ports = boost::pfr::tuple_size_v<Inputs>;
+
+  // Records the current values: returns whether anything changed.
+  // Everything counts as changed the first time.
+  bool update(const Inputs& inputs)
+  {
+    const bool first = !m_initialized;
+    update(inputs, std::make_index_sequence<ports>{});
+    return first || m_changed.any();
+  }
+
+  bool changed() const noexcept { return m_changed.any(); }
+  bool changed(int port) const noexcept { return m_changed.test(port); }
+
+  // Whether a port of the last inputs passed to update() changed
+  template <typename Port>
+  bool changed(const Port& port) const noexcept
+  {
+    for (int i = 0; i < ports; i++)
+      if (m_addresses[i] == &port)
+        return m_changed.test(i);
+    return true;
+  }
+
+private:
+  template <std::size_t... I>
+  void update(const Inputs& inputs, std::index_sequence<I...>)
+  {
+    m_changed.reset();
+    ((m_changed[I] = update_port<I>(boost::pfr::get<I>(inputs))), ...);
+    m_initialized = true;
+  }
+
+  template <std::size_t I, typename Port>
+  bool update_port(const Port& port)
+  {
+    m_addresses[I] = &port;
+    const bool changed = std::get<I>(m_values).update(port);
+    return changed || !m_initialized;
+  }
+
+  template <typename>
+  struct snapshots;
+
+  template <std::size_t... I>
+  struct snapshots<std::index_sequence<I...>>
+  {
+    using type = std::tuple<port_snapshot<boost::pfr::tuple_element_t<I, Inputs>>...>;
+  };
+
+  typename snapshots<std::make_index_sequence<ports>>::type m_values{};
+  std::bitset<ports> m_changed;
+  const void* m_addresses[ports > 0 ? ports : 1]{};
+  bool m_initialized{};
+};
+
+// Whether the host has to run update() this frame.
+// To be called on the thread running update(), before it, on every path:
+// it also takes the snapshot of the published controls for this frame.
+template <typename T>
+bool update_required(T& object)
+{
+  if constexpr (requires { object.controls.acquire(); })
+    object.controls.acquire();
+
+  if constexpr (requires { object.input_changes.update(object.inputs); })
+  {
+    bool changed{};
+    if constexpr (requires { object.input_changes.update(object.controls.inputs()); })
+      changed = object.input_changes.update(object.controls.inputs());
+    else
+      changed = object.input_changes.update(object.inputs);
+
+    if constexpr (requires { { object.needs_update() } -> std::convertible_to<bool>; })
+      return changed || object.needs_update();
+    else
+      return changed;
+  }
+  else
+  {
+    return true;
+  }
+}
+}
@@ -0,0 +1,297 @@
+#pragma once
+#include "helpers.hpp"
+#include <boost/pfr/core.hpp>
+
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <map>
+#include <unordered_map>
+
+namespace gpu
+{
+enum class resource_kind : std::uint8_t
+{
+  vertex,
+  index,
+  uniform,
+  storage,
+  texture
+};
+
+// Sits in front of a backend and accounts for the device memory allocated
+// by each node, against a global budget.
+//
+// Resources are resident unless their node marks them evictable with
+// set_residency. When an allocation would exceed the budget, evictable
+// resources are released, least recently used first: the node's handle is
+// set to null, and it allocates and fills the resource again on its next
+// update(). Resources used during the current frame are never evicted.
+// The host tells which node is running with begin(), and calls end_frame()
+// once the frame has been submitted.
+template <typename Backend>
+class memory_budget
+{
+public:
+  memory_budget(Backend& backend, std::size_t budget)
+      : m_backend{backend}
+      , m_budget{budget}
+  {
+  }
+
+  memory_budget(const memory_budget&) = delete;
+  memory_budget& operator=(const memory_budget&) = delete;
+
+  void begin(std::uint32_t node) noexcept { m_node = node; }
+  void end() noexcept { m_node = host_node; }
+
+  template <typename C>
+  typename C::return_type operator()(const C& command)
+  {
+    if constexpr (requires { C::allocation; C::staging; } || requires { C::allocation; C::sampler; })
+    {
+      return m_backend(command);
+    }
+    else if constexpr (requires { C::allocation; })
+    {
+      const std::size_t bytes = allocation_size(command);
+      make_room(bytes);
+
+      auto handle = m_backend(command);
+      if (handle)
+        add(handle, kind_of<C>(), bytes);
+      return handle;
+    }
+    else if constexpr (requires { C::deallocation; })
+    {
+      remove(command.handle);
+      return m_backend(command);
+    }
+    else if constexpr (requires { C::budget; C::residency; })
+    {
+      if (command.buffer && *command.buffer)
+        set_policy(*command.buffer, command.buffer, command.policy);
+      if (command.texture && *command.texture)
+        set_policy(*command.texture, command.texture, command.policy);
+      return m_backend(command);
+    }
+    else
+    {
+      boost::pfr::for_each_field(
+          command,
+          [this]<typename F>(const F& field)
+          {
+            if constexpr (std::is_same_v<F, buffer_handle> || std::is_same_v<F, texture_handle>)
+              touch(field);
+          });
+      return m_backend(command);
+    }
+  }
+
+  void end_frame()
+  {
+    if constexpr (requires { m_backend.end_frame(); })
+      m_backend.end_frame();
+    m_frame++;
+  }
+
+  bool owns_staging(const void* ptr) const
+  {
+    if constexpr (requires { m_backend.owns_staging(ptr); })
+      return m_backend.owns_staging(ptr);
+    else
+      return false;
+  }
+
+  std::size_t budget() const noexcept { return m_budget; }
+
+  // Lowering the budget evicts at the next allocation
+  void set_budget(std::size_t budget) noexcept { m_budget = budget; }
+
+  std::size_t usage() const noexcept { return m_usage; }
+  std::size_t usage(resource_kind kind) const noexcept { return m_usage_per_kind[int(kind)]; }
+  std::size_t usage(std::uint32_t node) const noexcept
+  {
+    auto it = m_usage_per_node.find(node);
+    return it != m_usage_per_node.end() ? it->second : 0;
+  }
+
+  std::size_t evictions() const noexcept { return m_evictions; }
+
+  static constexpr std::uint32_t host_node = 0xFFFFFFFF;
+
+private:
+  struct resource
+  {
+    std::uint32_t node{};
+    resource_kind kind{};
+    std::size_t bytes{};
+    std::uint64_t last_used{};
+
+    // Where the node keeps the handle, for evictable resources
+    buffer_handle* buffer_slot{};
+    texture_handle* texture_slot{};
+    bool evictable() const noexcept { return buffer_slot || texture_slot; }
+
+    // Only meaningful for evictable resources
+    std::list<const void*>::iterator lru{};
+  };
+
+  template <typename C>
+  static constexpr resource_kind kind_of() noexcept
+  {
+    if constexpr (requires { C::texture; })
+      return resource_kind::texture;
+    else if constexpr (requires { C::vertex; })
+      return resource_kind::vertex;
+    else if constexpr (requires { C::index; })
+      return resource_kind::index;
+    else if constexpr (requires { C::ubo; })
+      return resource_kind::uniform;
+    else
+      return resource_kind::storage;
+  }
+
+  static std::size_t allocation_size(const texture_allocation& command) noexcept
+  {
+    const int levels
+        = command.mip_levels > 0 ? command.mip_levels : mip_level_count(command.width, command.height);
+    std::size_t bytes = 0;
+    int w = command.width, h = command.height;
+    for (int mip = 0; mip < levels; mip++)
+    {
+      bytes += texture_bytes(command.format, w, h);
+      w = w > 1 ? w / 2 : 1;
+      h = h > 1 ? h / 2 : 1;
+    }
+    return bytes * (command.array_layers > 1 ? command.array_layers : 1);
+  }
+
+  template <typename C>
+  static std::size_t allocation_size(const C& command) noexcept
+  {
+    return command.size;
+  }
+
+  void add(const void* handle, resource_kind kind, std::size_t bytes)
+  {
+    auto& r = m_resources[handle];
+    r = resource{
+        .node = m_node,
+        .kind = kind,
+        .bytes = bytes,
+        .last_used = m_frame,
+        .buffer_slot = nullptr,
+        .texture_slot = nullptr,
+        .lru = {}};
+    account(r, +1);
+  }
+
+  void remove(const void* handle)
+  {
+    auto it = m_resources.find(handle);
+    if (it == m_resources.end())
+      return;
+    account(it->second, -1);
+    if (it->second.evictable())
+      m_lru.erase(it->second.lru);
+    m_resources.erase(it);
+  }
+
+  void account(const resource& r, int sign) noexcept
+  {
+    m_usage += sign * r.bytes;
+    m_usage_per_kind[int(r.kind)] += sign * r.bytes;
+    m_usage_per_node[r.node] += sign * r.bytes;
+  }
+
+  template <typename Handle>
+  void set_policy(Handle handle, Handle* slot, residency policy)
+  {
+    auto it = m_resources.find(handle);
+    if (it == m_resources.end())
+      return;
+
+    auto& r = it->second;
+    if (r.evictable())
+      m_lru.erase(r.lru);
+    r.buffer_slot = nullptr;
+    r.texture_slot = nullptr;
+    if (policy == residency::evictable)
+    {
+      if constexpr (std::is_same_v<Handle, texture_handle>)
+        r.texture_slot = slot;
+      else
+        r.buffer_slot = slot;
+      // In last_used order, as make_room relies on: the resource may
+      // not have been used since resources already in the list
+      auto pos = m_lru.end();
+      while (pos != m_lru.begin() && m_resources.at(*std::prev(pos)).last_used > r.last_used)
+        --pos;
+      r.lru = m_lru.insert(pos, handle);
+    }
+  }
+
+  // Most recently used last
+  void touch(const void* handle)
+  {
+    if (!handle)
+      return;
+    auto it = m_resources.find(handle);
+    if (it == m_resources.end())
+      return;
+
+    auto& r = it->second;
+    r.last_used = m_frame;
+    if (r.evictable())
+      m_lru.splice(m_lru.end(), m_lru, r.lru);
+  }
+
+  // The LRU list is in last_used order: past the first resource used in this
+  // frame, all the others were too
+  void make_room(std::size_t bytes)
+  {
+    for (auto it = m_lru.begin(); it != m_lru.end() && m_usage + bytes > m_budget;)
+    {
+      const void* handle = *it++;
+      auto& r = m_resources.at(handle);
+      if (r.last_used >= m_frame)
+        break;
+      evict(handle, r);
+    }
+  }
+
+  void evict(const void* handle, resource& r)
+  {
+    if (r.kind == resource_kind::texture)
+      m_backend(texture_release{.handle = (texture_handle)handle});
+    else if (r.kind == resource_kind::uniform)
+      m_backend(ubo_release{.handle = (buffer_handle)handle});
+    else
+      m_backend(buffer_release{.handle = (buffer_handle)handle});
+
+    // Only if the node has not moved on to another resource already
+    if (r.texture_slot && *r.texture_slot == handle)
+      *r.texture_slot = nullptr;
+    if (r.buffer_slot && *r.buffer_slot == handle)
+      *r.buffer_slot = nullptr;
+    remove(handle);
+    m_evictions++;
+  }
+
+  Backend& m_backend;
+  std::size_t m_budget{};
+
+  std::unordered_map<const void*, resource> m_resources;
+  std::list<const void*> m_lru;
+
+  std::size_t m_usage{};
+  std::array<std::size_t, 5> m_usage_per_kind{};
+  std::map<std::uint32_t, std::size_t> m_usage_per_node;
+  std::size_t m_evictions{};
+
+  std::uint32_t m_node{host_node};
+  std::uint64_t m_frame{};
+};
+}
@@ -0,0 +1,355 @@
+#pragma once
+#include "helpers.hpp"
+#include "texture_conversion.hpp"
+#include "vertex_packer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace gpu
+{
+struct mesh_statistics
+{
+  // Full-precision vertices and 32-bit indices, as given
+  std::size_t input_bytes{};
+  // What is uploaded
+  std::size_t output_bytes{};
+
+  // Average cache miss ratio: vertex shader invocations per triangle,
+  // with a FIFO post-transform cache. 0.5 is the ideal for regular grids.
+  float acmr_before{};
+  float acmr_after{};
+
+  std::size_t saved_bytes() const noexcept
+  {
+    return input_bytes > output_bytes ? input_bytes - output_bytes : 0;
+  }
+};
+
+namespace mesh
+{
+// Simulates a FIFO post-transform cache
+inline float acmr(const std::uint32_t* indices, std::size_t index_count, int cache_size)
+{
+  if (index_count < 3)
+    return 0.f;
+
+  std::vector<std::uint32_t> fifo(cache_size, ~0u);
+  std::size_t head = 0;
+  std::size_t misses = 0;
+  for (std::size_t i = 0; i < index_count; i++)
+  {
+    if (std::find(fifo.begin(), fifo.end(), indices[i]) == fifo.end())
+    {
+      fifo[head] = indices[i];
+      head = (head + 1) % cache_size;
+      misses++;
+    }
+  }
+  return float(misses) / float(index_count / 3);
+}
+
+// Reorders triangles for the post-transform vertex cache, in linear time.
+// After P. Sander, D. Nehab, J. Barczak, "Fast triangle reordering for
+// vertex locality and reduced overdraw" (Tipsify), SIGGRAPH 2007.
+inline void optimize_vertex_cache(
+    std::uint32_t* indices, std::size_t index_count, std::size_t vertex_count,
+    int cache_size = 16)
+{
+  const std::size_t triangle_count = index_count / 3;
+  if (triangle_count == 0 || vertex_count == 0)
+    return;
+
+  // Triangles using each vertex
+  std::vector<std::uint32_t> live(vertex_count);
+  for (std::size_t i = 0; i < triangle_count * 3; i++)
+    live[indices[i]]++;
+
+  std::vector<std::uint32_t> first(vertex_count + 1);
+  for (std::size_t v = 0; v < vertex_count; v++)
+    first[v + 1] = first[v] + live[v];
+
+  std::vector<std::uint32_t> adjacency(triangle_count * 3);
+  {
+    std::vector<std::uint32_t> fill(first.begin(), first.end() - 1);
+    for (std::size_t i = 0; i < triangle_count * 3; i++)
+      adjacency[fill[indices[i]]++] = std::uint32_t(i / 3);
+  }
+
+  std::vector<std::uint32_t> cache_time(vertex_count);
+  std::vector<char> emitted(triangle_count);
+  std::vector<std::uint32_t> dead_end;
+  std::vector<std::uint32_t> candidates;
+  std::vector<std::uint32_t> output;
+  output.reserve(triangle_count * 3);
+
+  const std::vector<std::uint32_t> source(indices, indices + triangle_count * 3);
+  std::uint32_t time = cache_size + 1;
+  std::size_t cursor = 1;
+  std::int64_t fanning = 0;
+
+  while (fanning >= 0)
+  {
+    candidates.clear();
+    for (std::uint32_t a = first[fanning]; a < first[fanning + 1]; a++)
+    {
+      const std::uint32_t t = adjacency[a];
+      if (emitted[t])
+        continue;
+
+      for (int k = 0; k < 3; k++)
+      {
+        const std::uint32_t v = source[t * 3 + k];
+        output.push_back(v);
+        dead_end.push_back(v);
+        candidates.push_back(v);
+        live[v]--;
+        if (time - cache_time[v] > std::uint32_t(cache_size))
+          cache_time[v] = time++;
+      }
+      emitted[t] = 1;
+    }
+
+    // Next fanning vertex: the most recent one still in the cache after
+    // emitting all its triangles
+    std::int64_t best = -1;
+    int best_priority = -1;
+    for (std::uint32_t v : candidates)
+    {
+      if (live[v] == 0)
+        continue;
+      int priority = 0;
+      if (time - cache_time[v] + 2 * live[v] <= std::uint32_t(cache_size))
+        priority = int(time - cache_time[v]);
+      if (priority > best_priority)
+      {
+        best_priority = priority;
+        best = v;
+      }
+    }
+
+    if (best < 0)
+    {
+      // Dead end: back to recently used vertices, then to the input order
+      while (!dead_end.empty() && best < 0)
+      {
+        const std::uint32_t v = dead_end.back();
+        dead_end.pop_back();
+        if (live[v] > 0)
+          best = v;
+      }
+      while (best < 0 && cursor < vertex_count)
+      {
+        if (live[cursor] > 0)
+          best = cursor;
+        cursor++;
+      }
+    }
+    fanning = best;
+  }
+
+  std::copy(output.begin(), output.end(), indices);
+}
+
+// Renumbers vertices in the order the indices first use them, so that
+// vertex fetches are sequential. Unused vertices get ~0u and are dropped.
+// Returns the number of vertices left.
+inline std::size_t optimize_vertex_fetch_remap(
+    std::uint32_t* remap, std::uint32_t* indices, std::size_t index_count,
+    std::size_t vertex_count)
+{
+  std::fill(remap, remap + vertex_count, ~0u);
+  std::uint32_t next = 0;
+  for (std::size_t i = 0; i < index_count; i++)
+  {
+    std::uint32_t& r = remap[indices[i]];
+    if (r == ~0u)
+      r = next++;
+    indices[i] = r;
+  }
+  return next;
+}
+
+// Converts a float to an attribute component
+template <typename C>
+C encode(float value) noexcept
+{
+  if constexpr (std::is_same_v<C, half>)
+    return half{conversion::f32_to_f16(value)};
+  else if constexpr (std::is_same_v<C, snorm16>)
+    return snorm16{std::int16_t(std::lround(std::clamp(value, -1.f, 1.f) * 32767.f))};
+  else if constexpr (std::is_same_v<C, unorm16>)
+    return unorm16{std::uint16_t(std::lround(std::clamp(value, 0.f, 1.f) * 65535.f))};
+  else
+    return C(value);
+}
+}
+
+// Optimization stage for geometry streamed through dynamic_vertex_upload and
+// dynamic_index_upload. Takes full-precision attributes and 32-bit indices,
+// in whatever order the node produced them, and makes:
+// - indices reordered for the post-transform vertex cache,
+// - vertices reordered in the order they are first fetched,
+// - 16-bit indices when there are few enough vertices,
+// - vertices interleaved as declared in the layout: attributes declared as
+//   gpu::half, gpu::snorm16 or gpu::unorm16 arrays get quantized, the
+//   preamble keeps declaring them as float vectors.
+//
+//   gpu::mesh_optimizer<decltype(layout::vertex_input)> mesh;
+//   mesh.optimize({positions, texcoords}, vertex_count, indices, index_count);
+//   co_yield gpu::dynamic_index_allocation{..., .format = mesh.index_type()};
+//   co_yield gpu::dynamic_vertex_upload{..., .size = mesh.vertex_bytes(), .data = mesh.vertex_data()};
+//
+// Results stay valid until the next optimize() call.
+template <typename VertexInput>
+class mesh_optimizer
+{
+  using packer = vertex_packer<VertexInput>;
+
+public:
+  static constexpr int attributes = packer::attributes;
+
+  // One array of floats per attribute, with as many components per vertex
+  // as the attribute has, e.g. 3 for a float[3] or a gpu::half[3]
+  using sources = std::array<const float*, attributes>;
+
+  struct options
+  {
+    bool reorder_triangles{true};
+    bool reorder_vertices{true};
+    bool small_indices{true};
+    int cache_size{16};
+  };
+
+  void optimize(
+      const sources& src, std::size_t vertex_count, const std::uint32_t* indices,
+      std::size_t index_count, options opts = {})
+  {
+    m_indices.assign(indices, indices + index_count);
+
+    m_stats = {};
+    m_stats.input_bytes = vertex_count * float_stride() + index_count * sizeof(std::uint32_t);
+    m_stats.acmr_before = mesh::acmr(m_indices.data(), index_count, opts.cache_size);
+
+    if (opts.reorder_triangles)
+      mesh::optimize_vertex_cache(m_indices.data(), index_count, vertex_count, opts.cache_size);
+
+    // m_remap[new vertex] = old vertex
+    if (opts.reorder_vertices)
+    {
+      std::vector<std::uint32_t>& new_index = m_scratch;
+      new_index.resize(vertex_count);
+      m_vertex_count = mesh::optimize_vertex_fetch_remap(
+          new_index.data(), m_indices.data(), index_count, vertex_count);
+      m_remap.resize(m_vertex_count);
+      for (std::size_t v = 0; v < vertex_count; v++)
+        if (new_index[v] != ~0u)
+          m_remap[new_index[v]] = v;
+    }
+    else
+    {
+      m_vertex_count = vertex_count;
+      m_remap.resize(vertex_count);
+      for (std::size_t v = 0; v < vertex_count; v++)
+        m_remap[v] = v;
+    }
+
+    m_stats.acmr_after = mesh::acmr(m_indices.data(), index_count, opts.cache_size);
+
+    write_vertices(src);
+    write_indices(opts.small_indices);
+    m_stats.output_bytes = m_vertices.size() + m_index_bytes;
+  }
+
+  void* vertex_data() noexcept { return m_vertices.data(); }
+  int vertex_bytes() const noexcept { return m_vertices.size(); }
+  std::size_t vertex_count() const noexcept { return m_vertex_count; }
+
+  void* index_data() noexcept { return m_indices.data(); }
+  int index_bytes() const noexcept { return m_index_bytes; }
+  std::size_t index_count() const noexcept { return m_indices.size(); }
+  index_format index_type() const noexcept { return m_index_format; }
+
+  const mesh_statistics& stats() const noexcept { return m_stats; }
+
+private:
+  static constexpr std::size_t float_stride() noexcept
+  {
+    std::size_t stride = 0;
+    [&]<std::size_t... I>(std::index_sequence<I...>)
+    {
+      ((stride += sizeof(float) * component_count<attribute_type<I>>()), ...);
+    }
+    (std::make_index_sequence<attributes>{});
+    return stride;
+  }
+
+  template <std::size_t I>
+  using attribute_type = decltype(reflect::member_t<I, VertexInput>::data);
+
+  void write_vertices(const sources& src)
+  {
+    m_vertices.resize(m_vertex_count * packer::stride);
+    [&]<std::size_t... I>(std::index_sequence<I...>)
+    {
+      (write_attribute<I>(src[I]), ...);
+    }
+    (std::make_index_sequence<attributes>{});
+  }
+
+  template <std::size_t I>
+  void write_attribute(const float* src)
+  {
+    using type = attribute_type<I>;
+    using component = std::remove_all_extents_t<type>;
+    constexpr int n = component_count<type>();
+    static_assert(sizeof(type) == n * sizeof(component));
+
+    char* out = m_vertices.data() + packer::offsets[I];
+    for (std::size_t v = 0; v < m_vertex_count; v++, out += packer::stride)
+    {
+      const float* in = src + std::size_t(m_remap[v]) * n;
+      component c[n];
+      for (int k = 0; k < n; k++)
+        c[k] = mesh::encode<component>(in[k]);
+      std::memcpy(out, c, sizeof(c));
+    }
+  }
+
+  void write_indices(bool small_indices)
+  {
+    if (small_indices && m_vertex_count <= 65536)
+    {
+      // Narrowed in place: each 16-bit index is written at or before the
+      // 32-bit one it comes from
+      auto narrow = reinterpret_cast<std::uint16_t*>(m_indices.data());
+      for (std::size_t i = 0; i < m_indices.size(); i++)
+      {
+        const std::uint16_t index = std::uint16_t(m_indices[i]);
+        std::memcpy(narrow + i, &index, sizeof(index));
+      }
+      m_index_format = index_format::uint16;
+      m_index_bytes = m_indices.size() * sizeof(std::uint16_t);
+    }
+    else
+    {
+      m_index_format = index_format::uint32;
+      m_index_bytes = m_indices.size() * sizeof(std::uint32_t);
+    }
+  }
+
+  std::vector<char> m_vertices;
+  std::vector<std::uint32_t> m_indices;
+  std::vector<std::uint32_t> m_remap;
+  std::vector<std::uint32_t> m_scratch;
+
+  std::size_t m_vertex_count{};
+  int m_index_bytes{};
+  index_format m_index_format{index_format::uint32};
+  mesh_statistics m_stats;
+};
+}
@@ -0,0 +1,178 @@
+#pragma once
+#include "helpers.hpp"
+#include "cpu_tasks.hpp"
+#include "texture_conversion.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// CPU mip chain generation: 2x2 box filter, vectorized per row,
+// with rows split across the workers of a thread pool for the larger levels.
+namespace gpu::mipmaps
+{
+// Runs f(first_row, last_row) on chunks of rows, on the pool's workers
+// and the calling thread if worth it. Not to be called from a worker of
+// the same pool, which could end up waiting for itself.
+template <typename F>
+void parallel_rows(int rows, std::size_t row_bytes, thread_pool* pool, F&& f)
+{
+  constexpr std::size_t min_bytes_per_thread = 256 * 1024;
+  const std::size_t total = rows * row_bytes;
+  const int threads
+      = pool ? std::min<int>({int(pool->size()) + 1, rows, int(total / min_bytes_per_thread)}) : 1;
+
+  if (threads <= 1)
+  {
+    f(0, rows);
+    return;
+  }
+
+  std::vector<std::future<void>> chunks;
+  chunks.reserve(threads - 1);
+  const int chunk = (rows + threads - 1) / threads;
+  for (int t = 1; t < threads; t++)
+  {
+    const int first = t * chunk;
+    const int last = std::min(rows, first + chunk);
+    if (first < last)
+      chunks.push_back(pool->submit([=, &f] { f(first, last); }));
+  }
+  f(0, std::min(rows, chunk));
+
+  // f lives on this stack: every chunk must be done before anything is rethrown
+  for (auto& c : chunks)
+    c.wait();
+  for (auto& c : chunks)
+    c.get();
+}
+
+// Averages 2x2 blocks of 8-bit channels, rounding to nearest
+inline void downsample_row_u8(
+    const std::uint8_t* r0, const std::uint8_t* r1, int src_width,
+    std::uint8_t* out, int dst_width, int channels)
+{
+  int x = 0;
+#if defined(__SSE2__)
+  if (channels == 4 && src_width > 1)
+  {
+    // 4 source pixels -> 2 destination pixels
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    for (; x + 2 <= dst_width; x += 2)
+    {
+      const __m128i a = _mm_loadu_si128((const __m128i*)(r0 + x * 8));
+      const __m128i b = _mm_loadu_si128((const __m128i*)(r1 + x * 8));
+      const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+      const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+      const __m128i sum_lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+      const __m128i sum_hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+      const __m128i sum = _mm_unpacklo_epi64(sum_lo, sum_hi);
+      const __m128i avg = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+      _mm_storel_epi64((__m128i*)(out + x * 4), _mm_packus_epi16(avg, zero));
+    }
+  }
+#endif
+  for (; x < dst_width; x++)
+  {
+    const int x0 = 2 * x;
+    const int x1 = std::min(2 * x + 1, src_width - 1);
+    for (int c = 0; c < channels; c++)
+    {
+      const unsigned sum = r0[x0 * channels + c] + r0[x1 * channels + c]
+                           + r1[x0 * channels + c] + r1[x1 * channels + c];
+      out[x * channels + c] = std::uint8_t((sum + 2) >> 2);
+    }
+  }
+}
+
+inline void downsample_row_f32(
+    const float* r0, const float* r1, int src_width,
+    float* out, int dst_width, int channels)
+{
+  int x = 0;
+#if defined(__SSE2__)
+  if (channels == 4 && src_width > 1)
+  {
+    const __m128 quarter = _mm_set1_ps(0.25f);
+    for (; x < dst_width; x++)
+    {
+      const __m128 a = _mm_add_ps(_mm_loadu_ps(r0 + x * 8), _mm_loadu_ps(r0 + x * 8 + 4));
+      const __m128 b = _mm_add_ps(_mm_loadu_ps(r1 + x * 8), _mm_loadu_ps(r1 + x * 8 + 4));
+      _mm_storeu_ps(out + x * 4, _mm_mul_ps(_mm_add_ps(a, b), quarter));
+    }
+  }
+#endif
+  for (; x < dst_width; x++)
+  {
+    const int x0 = 2 * x;
+    const int x1 = std::min(2 * x + 1, src_width - 1);
+    for (int c = 0; c < channels; c++)
+    {
+      const float sum = (r0[x0 * channels + c] + r0[x1 * channels + c])
+                        + (r1[x0 * channels + c] + r1[x1 * channels + c]);
+      out[x * channels + c] = sum * 0.25f;
+    }
+  }
+}
+
+// Writes the max(1, w/2) x max(1, h/2) level below "src".
+// Without a pool, everything runs on the calling thread.
+inline void downsample(
+    const char* src, int src_width, int src_height,
+    char* dst, texture_format format, thread_pool* pool = nullptr)
+{
+  const int dst_width = std::max(1, src_width / 2);
+  const int dst_height = std::max(1, src_height / 2);
+  const int channels = gpu::channels(format);
+  const std::size_t bpp = bytes_per_pixel(format);
+  const std::size_t src_pitch = src_width * bpp;
+  const std::size_t dst_pitch = dst_width * bpp;
+
+  parallel_rows(
+      dst_height, dst_pitch, pool,
+      [&](int first, int last)
+      {
+        // Half floats go through a float row
+        std::vector<float> f0, f1, fout;
+        if (channel_size(format) == 2)
+        {
+          f0.resize(src_width * channels);
+          f1.resize(src_width * channels);
+          fout.resize(dst_width * channels);
+        }
+
+        for (int y = first; y < last; y++)
+        {
+          const char* r0 = src + 2 * y * src_pitch;
+          const char* r1 = src + std::min(2 * y + 1, src_height - 1) * src_pitch;
+          char* out = dst + y * dst_pitch;
+          switch (channel_size(format))
+          {
+            case 1:
+              downsample_row_u8(
+                  (const std::uint8_t*)r0, (const std::uint8_t*)r1, src_width,
+                  (std::uint8_t*)out, dst_width, channels);
+              break;
+            case 4:
+              downsample_row_f32(
+                  (const float*)r0, (const float*)r1, src_width,
+                  (float*)out, dst_width, channels);
+              break;
+            case 2:
+              conversion::f16_to_f32((const std::uint16_t*)r0, f0.data(), f0.size());
+              conversion::f16_to_f32((const std::uint16_t*)r1, f1.data(), f1.size());
+              downsample_row_f32(
+                  f0.data(), f1.data(), src_width, fout.data(), dst_width, channels);
+              conversion::f32_to_f16(fout.data(), (std::uint16_t*)out, fout.size());
+              break;
+          }
+        }
+      });
+}
+}
@@ -0,0 +1,215 @@
+#pragma once
+#include "helpers.hpp"
+
+#include <array>
+#include <string_view>
+#include <vector>
+
+namespace gpu
+{
+// Sums a buffer of vec4 down to a single value on the device.
+// Each pass reduces local_size elements per workgroup in shared memory and
+// writes one value per workgroup ; passes ping-pong between two storage
+// buffers until a single value remains, so that only 16 bytes have to be
+// read back whatever the size of the input.
+//
+// It is shaped like any other compute node: backends run it when a node
+// yields gpu::reduce_buffer.
+struct reduction
+{
+  halp_meta(name, "Reduction");
+
+  static constexpr int local_size = 256;
+  using value_type = float[4];
+
+  struct layout
+  {
+    halp_meta(local_size_x, local_size)
+    halp_meta(local_size_y, 1)
+    halp_meta(local_size_z, 1)
+    halp_flags(compute);
+
+    struct bindings
+    {
+      struct {
+        halp_meta(name, "reduction_src");
+        halp_meta(binding, 0);
+        halp_flags(std430, buffer, readonly);
+
+        gpu::uniform<"src_values", value_type*> values;
+      } src;
+
+      struct {
+        halp_meta(name, "reduction_dst");
+        halp_meta(binding, 1);
+        halp_flags(std430, buffer, writeonly);
+
+        gpu::uniform<"dst_values", value_type*> values;
+      } dst;
+    } bindings;
+  };
+
+  // What to reduce: set by the backend before update() and dispatch()
+  buffer_handle source{};
+  int count{};
+
+  // Pending readback of the final value, once dispatch() has run
+  buffer_awaiter result{};
+
+  std::string_view compute()
+  {
+    return R"_(
+shared vec4 partial[gl_WorkGroupSize.x];
+
+void main()
+{
+  const uint local = gl_LocalInvocationID.x;
+  const uint index = gl_GlobalInvocationID.x;
+
+  // The bound range is exactly the number of values of the previous pass
+  partial[local] = index < uint(src_values.length()) ? src_values[index] : vec4(0);
+  barrier();
+
+  for (uint stride = gl_WorkGroupSize.x / 2; stride > 0; stride /= 2)
+  {
+    if (local < stride)
+      partial[local] += partial[local + stride];
+    barrier();
+  }
+
+  if (local == 0)
+    dst_values[gl_WorkGroupID.x] = partial[0];
+}
+)_";
+  }
+
+  // Number of values written by a pass reducing "n" values
+  static constexpr int groups(int n) { return (n + local_size - 1) / local_size; }
+
+  // Allocate the two intermediate buffers: the first pass writes the
+  // largest output, every other pass fits in the second buffer.
+  // They only grow: passes bind the exact range they use, so smaller counts,
+  // e.g. the edge tiles of a tiled node, reuse them as they are.
+  gpu::co_update update()
+  {
+    if (count > capacity && ping)
+    {
+      co_yield gpu::buffer_release{.handle = ping};
+      co_yield gpu::buffer_release{.handle = pong};
+      ping = nullptr;
+      pong = nullptr;
+    }
+
+    if (count > 0 && !ping)
+    {
+      capacity = count;
+      const int first = groups(count);
+      this->ping = co_yield gpu::static_allocation{
+          .binding = lay.bindings.dst.binding()
+        , .size = int(first * sizeof(value_type))
+      };
+      this->pong = co_yield gpu::static_allocation{
+          .binding = lay.bindings.dst.binding()
+        , .size = int(groups(first) * sizeof(value_type))
+      };
+    }
+  }
+
+  gpu::co_release release()
+  {
+    if (ping)
+    {
+      co_yield gpu::buffer_release{.handle = ping};
+      co_yield gpu::buffer_release{.handle = pong};
+      ping = nullptr;
+      pong = nullptr;
+    }
+  }
+
+  gpu::co_dispatch dispatch()
+  {
+    if (!source || count <= 0 || !ping)
+      co_return;
+
+    co_yield gpu::begin_compute_pass{};
+
+    buffer_handle src = source;
+    buffer_handle dst = ping;
+    int n = count;
+    do
+    {
+      const int out = groups(n);
+      co_yield gpu::bind_buffer{
+          .binding = lay.bindings.src.binding()
+        , .handle = src
+        , .offset = 0
+        , .size = int(n * sizeof(value_type))
+      };
+      co_yield gpu::bind_buffer{
+          .binding = lay.bindings.dst.binding()
+        , .handle = dst
+        , .offset = 0
+        , .size = int(out * sizeof(value_type))
+      };
+      co_yield gpu::compute_dispatch{.x = out, .y = 1, .z = 1};
+
+      src = dst;
+      dst = (dst == ping) ? pong : ping;
+      n = out;
+    } while (n > 1);
+
+    co_yield gpu::end_compute_pass{};
+
+    this->result = co_yield gpu::readback_buffer{
+        .handle = src
+      , .offset = 0
+      , .size = sizeof(value_type)
+    };
+  }
+
+  // CPU implementation following the exact same summation order as the
+  // shader, for testing backends against.
+  static std::array<float, 4> reference(const value_type* data, int count)
+  {
+    std::vector<std::array<float, 4>> values(count);
+    for (int i = 0; i < count; i++)
+      for (int c = 0; c < 4; c++)
+        values[i][c] = data[i][c];
+
+    if (values.empty())
+      return {};
+
+    do
+    {
+      const int n = values.size();
+      std::vector<std::array<float, 4>> next(groups(n));
+      for (int g = 0; g < int(next.size()); g++)
+      {
+        std::array<std::array<float, 4>, local_size> partial{};
+        for (int local = 0; local < local_size; local++)
+        {
+          const int index = g * local_size + local;
+          if (index < n)
+            partial[local] = values[index];
+        }
+
+        for (int stride = local_size / 2; stride > 0; stride /= 2)
+          for (int local = 0; local < stride; local++)
+            for (int c = 0; c < 4; c++)
+              partial[local][c] += partial[local + stride][c];
+
+        next[g] = partial[0];
+      }
+      values = std::move(next);
+    } while (values.size() > 1);
+
+    return values[0];
+  }
+
+private:
+  static constexpr auto lay = layout{};
+  int capacity{};
+  buffer_handle ping{};
+  buffer_handle pong{};
+};
+}
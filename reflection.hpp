@@ -0,0 +1,180 @@
+#pragma once
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+#if defined(GPP_REFLECTION_PFR)
+#include <boost/pfr/core.hpp>
+#endif
+
+// Reflection of the aggregates describing a layout: bindings, uniform
+// blocks, specialization constants, vertex inputs...
+//
+// The members are reached with a single structured binding, instead of
+// one boost::pfr::get per member, each of which ties the whole struct
+// again: this is linear instead of quadratic in the number of members,
+// and does not need pfr's headers. Field counts are computed once per
+// type. Define GPP_REFLECTION_PFR to go through boost::pfr instead, e.g.
+// to compare compile times with the compile_bench target.
+//
+// Members must not be C arrays (which pfr handles): layout structs only
+// hold structs such as gpu::uniform, which wrap their arrays.
+namespace gpu::reflect
+{
+inline constexpr std::size_t max_members = 32;
+
+namespace detail
+{
+// Never called: only used to count the initializers an aggregate accepts
+struct any_member
+{
+  template <typename T>
+  constexpr operator T() const noexcept;
+};
+
+template <typename T, std::size_t... I>
+constexpr bool initializable(std::index_sequence<I...>) noexcept
+{
+  return requires { T{(void(I), any_member{})...}; };
+}
+
+template <typename T, std::size_t N = 0>
+consteval std::size_t count_members() noexcept
+{
+  if constexpr (
+      N <= max_members
+      && initializable<T>(std::make_index_sequence<N + 1>{}))
+    return count_members<T, N + 1>();
+  else
+    return N;
+}
+
+template <std::size_t I, typename T, typename... Ts>
+struct nth_type
+{
+  using type = typename nth_type<I - 1, Ts...>::type;
+};
+
+template <typename T, typename... Ts>
+struct nth_type<0, T, Ts...>
+{
+  using type = T;
+};
+
+template <std::size_t I>
+struct nth_member
+{
+  template <typename... M>
+  constexpr auto operator()(M&...) const noexcept
+  {
+    using type = typename nth_type<I, M...>::type;
+    return std::type_identity<std::remove_cv_t<type>>{};
+  }
+};
+}
+
+#if defined(GPP_REFLECTION_PFR)
+template <typename T>
+inline constexpr std::size_t field_count
+    = boost::pfr::tuple_size_v<std::remove_cv_t<T>>;
+
+template <typename T, typename F>
+constexpr decltype(auto) visit_members(T& t, F&& f)
+{
+  return [&]<std::size_t... I>(std::index_sequence<I...>) -> decltype(auto)
+  {
+    return f(boost::pfr::get<I>(t)...);
+  }(std::make_index_sequence<field_count<T>>{});
+}
+#else
+template <typename T>
+inline constexpr std::size_t field_count
+    = detail::count_members<std::remove_cv_t<T>>();
+
+// Calls f with all the members of t at once
+template <typename T, typename F>
+constexpr decltype(auto) visit_members(T& t, F&& f)
+{
+  constexpr std::size_t count = field_count<T>;
+  static_assert(count <= max_members, "too many members to reflect");
+
+  if constexpr (count == 0)
+  {
+    return f();
+  }
+#define GPP_REFLECT_VISIT(N, ...) \
+  else if constexpr (count == N)  \
+  {                               \
+    auto& [__VA_ARGS__] = t;      \
+    return f(__VA_ARGS__);        \
+  }
+GPP_REFLECT_VISIT(1, m0)
+GPP_REFLECT_VISIT(2, m0, m1)
+GPP_REFLECT_VISIT(3, m0, m1, m2)
+GPP_REFLECT_VISIT(4, m0, m1, m2, m3)
+GPP_REFLECT_VISIT(5, m0, m1, m2, m3, m4)
+GPP_REFLECT_VISIT(6, m0, m1, m2, m3, m4, m5)
+GPP_REFLECT_VISIT(7, m0, m1, m2, m3, m4, m5, m6)
+GPP_REFLECT_VISIT(8, m0, m1, m2, m3, m4, m5, m6, m7)
+GPP_REFLECT_VISIT(9, m0, m1, m2, m3, m4, m5, m6, m7, m8)
+GPP_REFLECT_VISIT(10, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9)
+GPP_REFLECT_VISIT(11, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10)
+GPP_REFLECT_VISIT(12, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11)
+GPP_REFLECT_VISIT(13, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12)
+GPP_REFLECT_VISIT(14, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13)
+GPP_REFLECT_VISIT(15, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14)
+GPP_REFLECT_VISIT(16, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15)
+GPP_REFLECT_VISIT(17, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16)
+GPP_REFLECT_VISIT(18, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16, m17)
+GPP_REFLECT_VISIT(19, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16, m17, m18)
+GPP_REFLECT_VISIT(20, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16, m17, m18, m19)
+GPP_REFLECT_VISIT(21, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16, m17, m18, m19, m20)
+GPP_REFLECT_VISIT(22, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16, m17, m18, m19, m20, m21)
+GPP_REFLECT_VISIT(23, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16, m17, m18, m19, m20, m21, m22)
+GPP_REFLECT_VISIT(24, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16, m17, m18, m19, m20, m21, m22, m23)
+GPP_REFLECT_VISIT(25, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16, m17, m18, m19, m20, m21, m22, m23, m24)
+GPP_REFLECT_VISIT(26, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16, m17, m18, m19, m20, m21, m22, m23, m24, m25)
+GPP_REFLECT_VISIT(27, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16, m17, m18, m19, m20, m21, m22, m23, m24, m25, m26)
+GPP_REFLECT_VISIT(28, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16, m17, m18, m19, m20, m21, m22, m23, m24, m25, m26, m27)
+GPP_REFLECT_VISIT(29, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16, m17, m18, m19, m20, m21, m22, m23, m24, m25, m26, m27,
+    m28)
+GPP_REFLECT_VISIT(30, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16, m17, m18, m19, m20, m21, m22, m23, m24, m25, m26, m27,
+    m28, m29)
+GPP_REFLECT_VISIT(31, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16, m17, m18, m19, m20, m21, m22, m23, m24, m25, m26, m27,
+    m28, m29, m30)
+GPP_REFLECT_VISIT(32, m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+    m13, m14, m15, m16, m17, m18, m19, m20, m21, m22, m23, m24, m25, m26, m27,
+    m28, m29, m30, m31)
+#undef GPP_REFLECT_VISIT
+}
+#endif
+
+template <typename T, typename F>
+constexpr void for_each_member(T& t, F&& f)
+{
+  visit_members(t, [&f](auto&... m) { (f(m), ...); });
+}
+
+// Type of the I-th member of T
+template <std::size_t I, typename T>
+using member_t = typename decltype(visit_members(
+    std::declval<T&>(), detail::nth_member<I>{}))::type;
+}
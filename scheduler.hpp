@@ -0,0 +1,183 @@
+#pragma once
+#include "helpers.hpp"
+#include "input_tracking.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+namespace gpu
+{
+struct schedule_policy
+{
+  gpu::priority priority{priority::normal};
+
+  // The node runs at least once every this many frames, whatever the
+  // budget: 1 for every frame, 0 for no guarantee
+  int max_update_interval{};
+};
+
+// What a node declares, see gpu::priority
+template <typename Node>
+constexpr schedule_policy schedule_policy_of() noexcept
+{
+  schedule_policy policy;
+  if constexpr (requires { Node::update_priority(); })
+    policy.priority = Node::update_priority();
+  if constexpr (requires { Node::max_update_interval(); })
+    policy.max_update_interval = Node::max_update_interval();
+  return policy;
+}
+
+// Runs the update() and dispatch() of nodes within a CPU time budget per
+// frame, instead of dropping frames when they all do not fit.
+//
+// Each run of a node is timed, and its cost estimated from its last runs.
+// Every frame, the nodes which reached their max_update_interval run
+// first, then the others by decreasing priority, least recently run first,
+// as long as their estimated cost fits in what is left of the budget.
+// A node which does not fit keeps the resources and outputs of its last
+// run, and is tried again on the next frame.
+//
+//   gpu::node_scheduler<Backend> scheduler{std::chrono::milliseconds{4}};
+//   scheduler.add(filter);
+//   scheduler.add(analysis); // declares gpu::priority::low
+//   ...
+//   scheduler.run_frame(backend); // every frame
+template <typename Backend>
+class node_scheduler
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct node_statistics
+  {
+    std::string_view name;
+    std::chrono::nanoseconds cost{};
+    std::chrono::nanoseconds last_cost{};
+    std::uint64_t runs{};
+    std::uint64_t skips{};
+
+    // Frames since the node last ran: 0 if it ran in the last frame
+    int staleness{};
+  };
+
+  struct frame_statistics
+  {
+    std::chrono::nanoseconds elapsed{};
+    int ran{};
+    int skipped{};
+  };
+
+  explicit node_scheduler(std::chrono::nanoseconds budget) noexcept
+      : m_budget{budget}
+  {
+  }
+
+  // The node must outlive the scheduler. Returns its index in the statistics.
+  template <typename Node>
+  int add(Node& node, schedule_policy policy = schedule_policy_of<Node>())
+  {
+    entry e;
+    e.policy = policy;
+    if constexpr (requires { Node::name(); })
+      e.stats.name = Node::name();
+    e.run = [&node](Backend& backend) { run_node(node, backend); };
+    m_nodes.push_back(std::move(e));
+    return m_nodes.size() - 1;
+  }
+
+  void run_frame(Backend& backend)
+  {
+    m_order.resize(m_nodes.size());
+    for (std::size_t i = 0; i < m_nodes.size(); i++)
+      m_order[i] = i;
+
+    std::stable_sort(
+        m_order.begin(), m_order.end(),
+        [this](std::size_t a, std::size_t b)
+        {
+          const entry& ea = m_nodes[a];
+          const entry& eb = m_nodes[b];
+          if (ea.due() != eb.due())
+            return ea.due();
+          if (ea.policy.priority != eb.policy.priority)
+            return ea.policy.priority > eb.policy.priority;
+          return ea.stats.staleness > eb.stats.staleness;
+        });
+
+    m_last_frame = {};
+    const auto frame_start = clock::now();
+    for (std::size_t i : m_order)
+    {
+      entry& e = m_nodes[i];
+
+      // Nodes never measured yet always get a chance
+      const auto spent = clock::now() - frame_start;
+      if (!e.due() && e.stats.runs > 0 && spent + e.stats.cost > m_budget)
+      {
+        e.stats.staleness++;
+        e.stats.skips++;
+        m_last_frame.skipped++;
+        continue;
+      }
+
+      const auto start = clock::now();
+      e.run(backend);
+      const std::chrono::nanoseconds elapsed = clock::now() - start;
+
+      e.stats.last_cost = elapsed;
+      e.stats.cost = e.stats.runs == 0 ? elapsed : (e.stats.cost * 7 + elapsed) / 8;
+      e.stats.runs++;
+      e.stats.staleness = 0;
+      m_last_frame.ran++;
+    }
+    m_last_frame.elapsed = clock::now() - frame_start;
+  }
+
+  std::chrono::nanoseconds budget() const noexcept { return m_budget; }
+  void set_budget(std::chrono::nanoseconds budget) noexcept { m_budget = budget; }
+
+  const node_statistics& stats(int node) const noexcept { return m_nodes[node].stats; }
+  const frame_statistics& last_frame() const noexcept { return m_last_frame; }
+  int size() const noexcept { return m_nodes.size(); }
+
+private:
+  struct entry
+  {
+    schedule_policy policy{};
+    std::function<void(Backend&)> run;
+    node_statistics stats{};
+
+    bool due() const noexcept
+    {
+      return policy.max_update_interval > 0
+             && stats.staleness + 1 >= policy.max_update_interval;
+    }
+  };
+
+  template <typename Node>
+  static void run_node(Node& node, Backend& backend)
+  {
+    if (update_required(node))
+    {
+      for (auto& promise : node.update())
+        promise.feedback_value = execute<update_handle>(backend, promise.current_command);
+    }
+
+    if constexpr (requires { node.dispatch(); })
+    {
+      for (auto& promise : node.dispatch())
+        promise.feedback_value = execute<dispatch_handle>(backend, promise.current_command);
+    }
+  }
+
+  std::chrono::nanoseconds m_budget{};
+  std::vector<entry> m_nodes;
+  std::vector<std::size_t> m_order;
+  frame_statistics m_last_frame{};
+};
+}
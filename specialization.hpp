@@ -0,0 +1,121 @@
+#pragma once
+#include "helpers.hpp"
+
+#include <array>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Backend-side support for the specialization constants of a layout
+namespace gpu
+{
+// Same information as a VkSpecializationMapEntry
+struct specialization_entry
+{
+  int constant_id;
+  int offset;
+  int size;
+};
+
+// Constant ids, offsets and sizes of the members of a layout's
+// "specialization" struct, packed contiguously in declaration order.
+template <typename Spec>
+consteval auto specialization_entries()
+{
+  constexpr int field_count = reflect::field_count<Spec>;
+  std::array<specialization_entry, field_count> entries{};
+  int offset = 0;
+  int index = 0;
+  auto func = [&]<typename F>(const F& field)
+  {
+    entries[index++] = {F::constant_id(), offset, (int)sizeof(field.value)};
+    offset += sizeof(field.value);
+  };
+
+  constexpr Spec t{};
+  reflect::for_each_member(t, func);
+  return entries;
+}
+
+// Current values of the specialization constants of a pipeline.
+// The packed bytes are both what is given to the driver and the key
+// under which the specialized pipeline is cached.
+class specialization_state
+{
+public:
+  specialization_state() = default;
+
+  template <typename Spec>
+  explicit specialization_state(const Spec& spec)
+  {
+    for (auto entry : specialization_entries<Spec>())
+      m_entries.push_back(entry);
+
+    reflect::for_each_member(
+        spec,
+        [this](const auto& field)
+        {
+          m_data.append(
+              reinterpret_cast<const char*>(&field.value),
+              sizeof(field.value));
+        });
+  }
+
+  // Returns true if the value actually changed.
+  // Throws for a constant the layout does not have, or of another size:
+  // the shader would silently keep its previous value.
+  bool set(int constant_id, const void* data, int size)
+  {
+    for (const auto& entry : m_entries)
+    {
+      if (entry.constant_id != constant_id)
+        continue;
+      if (entry.size != size)
+        throw std::invalid_argument{"specialization constant of the wrong size"};
+
+      char* dst = m_data.data() + entry.offset;
+      if (std::memcmp(dst, data, size) == 0)
+        return false;
+
+      std::memcpy(dst, data, size);
+      return true;
+    }
+    throw std::invalid_argument{"unknown specialization constant"};
+  }
+
+  const std::vector<specialization_entry>& entries() const noexcept
+  {
+    return m_entries;
+  }
+
+  std::string_view key() const noexcept { return m_data; }
+
+private:
+  std::vector<specialization_entry> m_entries;
+  std::string m_data;
+};
+
+// Pipelines already specialized from a compiled shader.
+// Going back to a set of values seen before is a single lookup.
+template <typename Pipeline>
+class pipeline_cache
+{
+public:
+  template <typename F>
+  Pipeline& get(std::string_view key, F&& specialize)
+  {
+    auto it = m_pipelines.find(key);
+    if (it == m_pipelines.end())
+      it = m_pipelines.emplace(std::string{key}, specialize()).first;
+    return it->second;
+  }
+
+  std::size_t size() const noexcept { return m_pipelines.size(); }
+
+private:
+  std::map<std::string, Pipeline, std::less<>> m_pipelines;
+};
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "helpers.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace gpu
+{
+// Linear allocator for the payloads of upload commands.
+// Nodes get memory from it through gpu::allocate_staging and write their
+// data there instead of in their own scratch vectors ; everything stays
+// valid until the backend submitted the frame and calls reset().
+//
+// Allocations are a pointer bump. When a frame needs more than a block,
+// more blocks are chained, and the next reset() replaces them with a single
+// one large enough for the whole frame.
+class staging_arena
+{
+public:
+  explicit staging_arena(std::size_t block_size = 1 << 20)
+      : m_block_size{block_size}
+  {
+  }
+
+  staging_arena(const staging_arena&) = delete;
+  staging_arena& operator=(const staging_arena&) = delete;
+
+  // "align" must be a power of two
+  staging_view allocate(std::size_t size, std::size_t align = 16)
+  {
+    if (!m_blocks.empty())
+    {
+      if (auto ptr = bump(m_blocks.back(), size, align))
+        return {.data = ptr, .size = int(size)};
+    }
+
+    // Room for the worst-case alignment padding too
+    auto& blk = m_blocks.emplace_back(std::max(m_block_size, size + align));
+    return {.data = bump(blk, size, align), .size = int(size)};
+  }
+
+  // Whether a pointer is in the memory handed out since the last reset,
+  // i.e. whether the backend can keep it until submission instead of copying
+  bool owns(const void* ptr) const noexcept
+  {
+    auto p = static_cast<const char*>(ptr);
+    for (const auto& blk : m_blocks)
+      if (p >= blk.data.get() && p < blk.data.get() + blk.used)
+        return true;
+    return false;
+  }
+
+  // Bytes handed out since the last reset, padding included
+  std::size_t used() const noexcept
+  {
+    std::size_t sz = 0;
+    for (const auto& blk : m_blocks)
+      sz += blk.used;
+    return sz;
+  }
+
+  // At the end of the frame: all the memory handed out becomes invalid
+  void reset()
+  {
+    if (m_blocks.size() > 1)
+    {
+      std::size_t total = 0;
+      for (const auto& blk : m_blocks)
+        total += blk.size;
+      m_blocks.clear();
+      m_blocks.emplace_back(total);
+    }
+    else if (!m_blocks.empty())
+    {
+      m_blocks.front().used = 0;
+    }
+  }
+
+private:
+  struct block
+  {
+    explicit block(std::size_t sz)
+        : data{std::make_unique_for_overwrite<char[]>(sz)}
+        , size{sz}
+    {
+    }
+
+    std::unique_ptr<char[]> data;
+    std::size_t size{};
+    std::size_t used{};
+  };
+
+  static char* bump(block& blk, std::size_t size, std::size_t align) noexcept
+  {
+    const auto base = reinterpret_cast<std::uintptr_t>(blk.data.get());
+    const auto start = (base + blk.used + align - 1) & ~(std::uintptr_t(align) - 1);
+    const auto end = start - base + size;
+    if (end > blk.size)
+      return nullptr;
+
+    blk.used = end;
+    return blk.data.get() + (start - base);
+  }
+
+  std::vector<block> m_blocks;
+  std::size_t m_block_size{};
+};
+}
@@ -0,0 +1,423 @@
+#pragma once
+#include "helpers.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// Pixel conversion kernels used on upload, so that textures can be kept in
+// the smallest format that fits whatever the layout of the node-side data.
+// Each kernel has an SSE path when the target supports it ;
+// the scalar paths give the exact same results, bit for bit
+// (NaNs included: they are quieted and keep their truncated payload, as F16C does).
+namespace gpu::conversion
+{
+// rgb8 -> rgba8, with an opaque alpha
+inline void rgb8_to_rgba8(const std::uint8_t* src, std::uint8_t* dst, std::size_t pixels)
+{
+  std::size_t i = 0;
+#if defined(__SSSE3__)
+  // 16 pixels: 3 loads of 16 bytes give 4 stores of 16 bytes
+  const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i alpha = _mm_set1_epi32(0xff000000);
+  for (; i + 16 <= pixels; i += 16)
+  {
+    const __m128i a = _mm_loadu_si128((const __m128i*)(src + i * 3));
+    const __m128i b = _mm_loadu_si128((const __m128i*)(src + i * 3 + 16));
+    const __m128i c = _mm_loadu_si128((const __m128i*)(src + i * 3 + 32));
+
+    const __m128i p0 = a;
+    const __m128i p1 = _mm_alignr_epi8(b, a, 12);
+    const __m128i p2 = _mm_alignr_epi8(c, b, 8);
+    const __m128i p3 = _mm_srli_si128(c, 4);
+
+    auto out = (__m128i*)(dst + i * 4);
+    _mm_storeu_si128(out + 0, _mm_or_si128(_mm_shuffle_epi8(p0, shuffle), alpha));
+    _mm_storeu_si128(out + 1, _mm_or_si128(_mm_shuffle_epi8(p1, shuffle), alpha));
+    _mm_storeu_si128(out + 2, _mm_or_si128(_mm_shuffle_epi8(p2, shuffle), alpha));
+    _mm_storeu_si128(out + 3, _mm_or_si128(_mm_shuffle_epi8(p3, shuffle), alpha));
+  }
+#endif
+  for (; i < pixels; i++)
+  {
+    dst[i * 4 + 0] = src[i * 3 + 0];
+    dst[i * 4 + 1] = src[i * 3 + 1];
+    dst[i * 4 + 2] = src[i * 3 + 2];
+    dst[i * 4 + 3] = 255;
+  }
+}
+
+// bgra8 <-> rgba8
+inline void swap_red_blue(const std::uint8_t* src, std::uint8_t* dst, std::size_t pixels)
+{
+  std::size_t i = 0;
+#if defined(__SSSE3__)
+  const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+  for (; i + 4 <= pixels; i += 4)
+  {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 4));
+    _mm_storeu_si128((__m128i*)(dst + i * 4), _mm_shuffle_epi8(v, shuffle));
+  }
+#endif
+  for (; i < pixels; i++)
+  {
+    const std::uint8_t r = src[i * 4 + 0];
+    dst[i * 4 + 0] = src[i * 4 + 2];
+    dst[i * 4 + 1] = src[i * 4 + 1];
+    dst[i * 4 + 2] = r;
+    dst[i * 4 + 3] = src[i * 4 + 3];
+  }
+}
+
+// Normalized 8-bit -> float, per channel
+inline void u8_to_f32(const std::uint8_t* src, float* dst, std::size_t count)
+{
+  constexpr float scale = 1.f / 255.f;
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 vscale = _mm_set1_ps(scale);
+  for (; i + 16 <= count; i += 16)
+  {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+    const __m128i lo = _mm_unpacklo_epi8(v, zero);
+    const __m128i hi = _mm_unpackhi_epi8(v, zero);
+    const __m128i q0 = _mm_unpacklo_epi16(lo, zero);
+    const __m128i q1 = _mm_unpackhi_epi16(lo, zero);
+    const __m128i q2 = _mm_unpacklo_epi16(hi, zero);
+    const __m128i q3 = _mm_unpackhi_epi16(hi, zero);
+    _mm_storeu_ps(dst + i + 0, _mm_mul_ps(_mm_cvtepi32_ps(q0), vscale));
+    _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(q1), vscale));
+    _mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(q2), vscale));
+    _mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(q3), vscale));
+  }
+#endif
+  for (; i < count; i++)
+    dst[i] = float(src[i]) * scale;
+}
+
+// float -> normalized 8-bit, per channel: clamped to [0, 1] (NaN giving 0)
+// and rounded to nearest even
+inline void f32_to_u8(const float* src, std::uint8_t* dst, std::size_t count)
+{
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.f);
+  const __m128 scale = _mm_set1_ps(255.f);
+  auto to_int = [&](const float* p)
+  {
+    const __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(p), zero), one);
+    return _mm_cvtps_epi32(_mm_mul_ps(v, scale));
+  };
+  for (; i + 16 <= count; i += 16)
+  {
+    const __m128i lo = _mm_packs_epi32(to_int(src + i), to_int(src + i + 4));
+    const __m128i hi = _mm_packs_epi32(to_int(src + i + 8), to_int(src + i + 12));
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+  }
+#endif
+  for (; i < count; i++)
+  {
+    float v = src[i] > 0.f ? src[i] : 0.f;
+    v = v < 1.f ? v : 1.f;
+    dst[i] = std::uint8_t(std::nearbyint(v * 255.f));
+  }
+}
+
+// IEEE half <-> float, round to nearest even.
+// Scalar versions after F. Giesen's float_to_half_fast3_rtne / half_to_float.
+inline std::uint16_t f32_to_f16(float value) noexcept
+{
+  constexpr std::uint32_t f32_infinity = 255 << 23;
+  constexpr std::uint32_t f16_max = (127 + 16) << 23;
+  constexpr std::uint32_t denorm_magic = ((127 - 15) + (23 - 10) + 1) << 23;
+
+  std::uint32_t f = std::bit_cast<std::uint32_t>(value);
+  const std::uint32_t sign = f & 0x80000000u;
+  f ^= sign;
+
+  std::uint32_t out;
+  if (f >= f16_max)
+  {
+    // Infinity or NaN: quiet, keeping the top of the payload
+    out = (f > f32_infinity) ? 0x7e00 | ((f >> 13) & 0x3ff) : 0x7c00;
+  }
+  else if (f < (113 << 23))
+  {
+    // Subnormal or zero: let the FPU do the rounding
+    float sub = std::bit_cast<float>(f) + std::bit_cast<float>(denorm_magic);
+    out = std::bit_cast<std::uint32_t>(sub) - denorm_magic;
+  }
+  else
+  {
+    const std::uint32_t mantissa_odd = (f >> 13) & 1;
+    f += (std::uint32_t(15 - 127) << 23) + 0xfff;
+    f += mantissa_odd;
+    out = f >> 13;
+  }
+  return std::uint16_t(out | (sign >> 16));
+}
+
+inline float f16_to_f32(std::uint16_t value) noexcept
+{
+  constexpr std::uint32_t magic = 113 << 23;
+  constexpr std::uint32_t shifted_exponent = 0x7c00 << 13;
+
+  std::uint32_t out = (value & 0x7fff) << 13;
+  const std::uint32_t exponent = shifted_exponent & out;
+  out += (127 - 15) << 23;
+
+  if (exponent == shifted_exponent)
+  {
+    // Infinity or NaN, quieted
+    out += (128 - 16) << 23;
+    if (value & 0x3ff)
+      out |= 0x400000;
+  }
+  else if (exponent == 0)
+  {
+    // Zero or subnormal: renormalize
+    out += 1 << 23;
+    out = std::bit_cast<std::uint32_t>(
+        std::bit_cast<float>(out) - std::bit_cast<float>(magic));
+  }
+
+  out |= std::uint32_t(value & 0x8000) << 16;
+  return std::bit_cast<float>(out);
+}
+
+inline void f32_to_f16(const float* src, std::uint16_t* dst, std::size_t count)
+{
+  std::size_t i = 0;
+#if defined(__F16C__)
+  for (; i + 4 <= count; i += 4)
+  {
+    const __m128i h = _mm_cvtps_ph(_mm_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storel_epi64((__m128i*)(dst + i), h);
+  }
+#endif
+  for (; i < count; i++)
+    dst[i] = f32_to_f16(src[i]);
+}
+
+inline void f16_to_f32(const std::uint16_t* src, float* dst, std::size_t count)
+{
+  std::size_t i = 0;
+#if defined(__F16C__)
+  for (; i + 4 <= count; i += 4)
+  {
+    const __m128i h = _mm_loadl_epi64((const __m128i*)(src + i));
+    _mm_storeu_ps(dst + i, _mm_cvtph_ps(h));
+  }
+#endif
+  for (; i < count; i++)
+    dst[i] = f16_to_f32(src[i]);
+}
+
+// x * a / 255, rounded, without a division
+inline std::uint8_t multiply_u8(unsigned x, unsigned a) noexcept
+{
+  const unsigned t = x * a + 128;
+  return std::uint8_t((t + (t >> 8)) >> 8);
+}
+
+inline void premultiply_rgba8(std::uint8_t* data, std::size_t pixels)
+{
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  // Per 16-bit lane: keep the alpha of rgb lanes, multiply alpha by 255
+  const __m128i rgb_mask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+  const __m128i alpha_one = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+  const __m128i bias = _mm_set1_epi16(128);
+  auto multiply = [&](__m128i v)
+  {
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xff), 0xff);
+    alpha = _mm_or_si128(_mm_and_si128(alpha, rgb_mask), alpha_one);
+    const __m128i t = _mm_add_epi16(_mm_mullo_epi16(v, alpha), bias);
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+  };
+  for (; i + 4 <= pixels; i += 4)
+  {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(data + i * 4));
+    const __m128i lo = multiply(_mm_unpacklo_epi8(v, zero));
+    const __m128i hi = multiply(_mm_unpackhi_epi8(v, zero));
+    _mm_storeu_si128((__m128i*)(data + i * 4), _mm_packus_epi16(lo, hi));
+  }
+#endif
+  for (; i < pixels; i++)
+  {
+    const unsigned a = data[i * 4 + 3];
+    data[i * 4 + 0] = multiply_u8(data[i * 4 + 0], a);
+    data[i * 4 + 1] = multiply_u8(data[i * 4 + 1], a);
+    data[i * 4 + 2] = multiply_u8(data[i * 4 + 2], a);
+  }
+}
+
+inline void premultiply_rgba32f(float* data, std::size_t pixels)
+{
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  const __m128 rgb_mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+  const __m128 alpha_one = _mm_set_ps(1.f, 0.f, 0.f, 0.f);
+  for (; i < pixels; i++)
+  {
+    const __m128 v = _mm_loadu_ps(data + i * 4);
+    __m128 alpha = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+    alpha = _mm_or_ps(_mm_and_ps(alpha, rgb_mask), alpha_one);
+    _mm_storeu_ps(data + i * 4, _mm_mul_ps(v, alpha));
+  }
+#endif
+  for (; i < pixels; i++)
+  {
+    const float a = data[i * 4 + 3];
+    data[i * 4 + 0] *= a;
+    data[i * 4 + 1] *= a;
+    data[i * 4 + 2] *= a;
+  }
+}
+}
+
+namespace gpu
+{
+// Converts "pixels" pixels between two formats with the same channels
+// (plus rgb8 -> rgba and bgra8 <-> rgba8).
+// Returns false if the conversion is not supported.
+inline bool convert_pixels(
+    const void* src, texture_format src_format,
+    void* dst, texture_format dst_format,
+    std::size_t pixels)
+{
+  using namespace gpu::conversion;
+  const auto s8 = static_cast<const std::uint8_t*>(src);
+  const auto d8 = static_cast<std::uint8_t*>(dst);
+
+  if (src_format == dst_format)
+  {
+    std::memcpy(dst, src, pixels * bytes_per_pixel(src_format));
+    return true;
+  }
+
+  if (src_format == texture_format::rgb8)
+  {
+    if (dst_format == texture_format::rgba8)
+    {
+      rgb8_to_rgba8(s8, d8, pixels);
+      return true;
+    }
+
+    // Expand to rgba8 in chunks first
+    if (channels(dst_format) != 4 || dst_format == texture_format::bgra8)
+      return false;
+
+    constexpr std::size_t chunk = 256;
+    std::uint8_t rgba[chunk * 4];
+    const int dst_pixel = bytes_per_pixel(dst_format);
+    for (std::size_t i = 0; i < pixels; i += chunk)
+    {
+      const std::size_t n = std::min(chunk, pixels - i);
+      rgb8_to_rgba8(s8 + i * 3, rgba, n);
+      convert_pixels(rgba, texture_format::rgba8, d8 + i * dst_pixel, dst_format, n);
+    }
+    return true;
+  }
+
+  if ((src_format == texture_format::bgra8 && dst_format == texture_format::rgba8)
+      || (src_format == texture_format::rgba8 && dst_format == texture_format::bgra8))
+  {
+    swap_red_blue(s8, d8, pixels);
+    return true;
+  }
+
+  if (channels(src_format) != channels(dst_format)
+      || src_format == texture_format::bgra8 || dst_format == texture_format::bgra8)
+    return false;
+
+  const std::size_t count = pixels * channels(src_format);
+  const int src_size = channel_size(src_format);
+  const int dst_size = channel_size(dst_format);
+  if (src_size == 1 && dst_size == 4)
+  {
+    u8_to_f32(s8, static_cast<float*>(dst), count);
+  }
+  else if (src_size == 4 && dst_size == 1)
+  {
+    f32_to_u8(static_cast<const float*>(src), d8, count);
+  }
+  else if (src_size == 4 && dst_size == 2)
+  {
+    f32_to_f16(static_cast<const float*>(src), static_cast<std::uint16_t*>(dst), count);
+  }
+  else if (src_size == 2 && dst_size == 4)
+  {
+    f16_to_f32(static_cast<const std::uint16_t*>(src), static_cast<float*>(dst), count);
+  }
+  else
+  {
+    // 8-bit <-> half, through floats
+    constexpr std::size_t chunk = 1024;
+    float tmp[chunk];
+    for (std::size_t i = 0; i < count; i += chunk)
+    {
+      const std::size_t n = std::min(chunk, count - i);
+      if (src_size == 1)
+      {
+        u8_to_f32(s8 + i, tmp, n);
+        f32_to_f16(tmp, static_cast<std::uint16_t*>(dst) + i, n);
+      }
+      else
+      {
+        f16_to_f32(static_cast<const std::uint16_t*>(src) + i, tmp, n);
+        f32_to_u8(tmp, d8 + i, n);
+      }
+    }
+  }
+  return true;
+}
+
+// Premultiplies rgba pixels in place by their alpha.
+// Returns false for formats without alpha.
+inline bool premultiply(void* data, texture_format format, std::size_t pixels)
+{
+  using namespace gpu::conversion;
+  switch (format)
+  {
+    case texture_format::rgba8:
+    case texture_format::bgra8:
+      premultiply_rgba8(static_cast<std::uint8_t*>(data), pixels);
+      return true;
+    case texture_format::rgba32f:
+      premultiply_rgba32f(static_cast<float*>(data), pixels);
+      return true;
+    case texture_format::rgba16f:
+    {
+      constexpr std::size_t chunk = 256;
+      float tmp[chunk * 4];
+      auto half = static_cast<std::uint16_t*>(data);
+      for (std::size_t i = 0; i < pixels; i += chunk)
+      {
+        const std::size_t n = std::min(chunk, pixels - i);
+        f16_to_f32(half + i * 4, tmp, n * 4);
+        premultiply_rgba32f(tmp, n);
+        f32_to_f16(tmp, half + i * 4, n * 4);
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include "helpers.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace gpu
+{
+// Pixels in host memory, e.g. a memory-mapped image file far larger than
+// any texture the device would accept
+struct image_view
+{
+  const void* data{};
+  int width{};
+  int height{};
+  texture_format format{texture_format::rgba8};
+
+  // 0 means tightly packed
+  int row_pitch{};
+
+  int pitch() const noexcept
+  {
+    return row_pitch > 0 ? row_pitch : width * bytes_per_pixel(format);
+  }
+
+  const char* pixel(int x, int y) const noexcept
+  {
+    return static_cast<const char*>(data) + std::size_t(y) * pitch()
+           + std::size_t(x) * bytes_per_pixel(format);
+  }
+};
+
+// A tile produces the pixels of its core rectangle, and reads those of its
+// source rectangle: the core extended by the halo, clamped to the image.
+struct tile
+{
+  int index{};
+  int x{}, y{};
+  int width{}, height{};
+
+  int source_x{}, source_y{};
+  int source_width{}, source_height{};
+
+  // Where the core is in the source rectangle
+  int core_x() const noexcept { return x - source_x; }
+  int core_y() const noexcept { return y - source_y; }
+};
+
+// Splits an image in tiles of at most tile_size pixels, plus halo on
+// each side, in row-major order. Edge tiles are smaller.
+class tile_grid
+{
+public:
+  tile_grid(int width, int height, int tile_size, int halo = 0) noexcept
+      : m_width{width}
+      , m_height{height}
+      , m_tile_size{std::max(1, tile_size)}
+      , m_halo{std::max(0, halo)}
+  {
+  }
+
+  int columns() const noexcept { return (m_width + m_tile_size - 1) / m_tile_size; }
+  int rows() const noexcept { return (m_height + m_tile_size - 1) / m_tile_size; }
+  int size() const noexcept { return m_width > 0 && m_height > 0 ? columns() * rows() : 0; }
+
+  // What a texture must hold for any tile of the grid
+  int max_source_width() const noexcept
+  {
+    return std::min(m_width, m_tile_size + 2 * m_halo);
+  }
+  int max_source_height() const noexcept
+  {
+    return std::min(m_height, m_tile_size + 2 * m_halo);
+  }
+
+  tile operator[](int index) const noexcept
+  {
+    tile t{.index = index};
+    t.x = (index % columns()) * m_tile_size;
+    t.y = (index / columns()) * m_tile_size;
+    t.width = std::min(m_tile_size, m_width - t.x);
+    t.height = std::min(m_tile_size, m_height - t.y);
+
+    t.source_x = std::max(0, t.x - m_halo);
+    t.source_y = std::max(0, t.y - m_halo);
+    t.source_width = std::min(m_width, t.x + t.width + m_halo) - t.source_x;
+    t.source_height = std::min(m_height, t.y + t.height + m_halo) - t.source_y;
+    return t;
+  }
+
+private:
+  int m_width{};
+  int m_height{};
+  int m_tile_size{};
+  int m_halo{};
+};
+
+// Uploads the source rectangle of a tile at the top-left of a texture,
+// straight from the rows of the image: nothing is copied on the host.
+// The image must outlive the frame.
+inline texture_upload upload_tile(const image_view& image, const tile& t, texture_handle dst)
+{
+  return texture_upload{
+      .handle = dst,
+      .offset = 0,
+      .size = (t.source_height - 1) * image.pitch() + t.source_width * bytes_per_pixel(image.format),
+      .data = const_cast<char*>(image.pixel(t.source_x, t.source_y)),
+      .x = 0,
+      .y = 0,
+      .width = t.source_width,
+      .height = t.source_height,
+      .row_pitch = image.pitch(),
+      .data_format = image.format};
+}
+
+// Copies the core of a tile's output to its place in the full output.
+// The tile's output covers its source rectangle, tightly packed.
+inline void merge_tile(
+    void* dst, int dst_row_pitch, const tile& t, const void* tile_pixels, int bytes_per_pixel)
+{
+  const int src_pitch = t.source_width * bytes_per_pixel;
+  const int row_bytes = t.width * bytes_per_pixel;
+  auto src = static_cast<const char*>(tile_pixels) + std::size_t(t.core_y()) * src_pitch
+             + std::size_t(t.core_x()) * bytes_per_pixel;
+  auto out = static_cast<char*>(dst) + std::size_t(t.y) * dst_row_pitch
+             + std::size_t(t.x) * bytes_per_pixel;
+  for (int row = 0; row < t.height; row++)
+    std::memcpy(out + std::size_t(row) * dst_row_pitch, src + std::size_t(row) * src_pitch, row_bytes);
+}
+}
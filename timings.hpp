@@ -0,0 +1,139 @@
+#pragma once
+#include "helpers.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace gpu
+{
+// Per-node pass timings, gathered by the host without ever waiting for
+// the device: passes are wrapped in begin_query / end_query, and the
+// results are collected frames later, once the backend has them.
+//
+//   timings.begin(backend, node_id);
+//   handle_dispatch(node, backend);
+//   timings.end(backend, node_id);
+//   ...
+//   timings.collect(backend); // every frame
+//
+// Each node keeps its last "window" samples, which p50 / p99 are over.
+class pass_timings
+{
+public:
+  struct summary
+  {
+    std::uint32_t node{};
+    std::size_t samples{};
+    double p50_ms{};
+    double p99_ms{};
+  };
+
+  explicit pass_timings(std::size_t window = 256)
+      : m_window{window}
+  {
+  }
+
+  template <typename Backend>
+  void begin(Backend& backend, std::uint32_t node)
+  {
+    auto [it, inserted] = m_open.try_emplace(node);
+    if (!inserted)
+    {
+      // The previous pass was never ended: its timing means nothing, but
+      // the backend only recycles the query once it has been awaited
+      backend(end_query{.handle = it->second});
+      m_pending.push_back({node, it->second, true});
+    }
+    it->second = backend(begin_query{});
+  }
+
+  template <typename Backend>
+  void end(Backend& backend, std::uint32_t node)
+  {
+    auto it = m_open.find(node);
+    if (it == m_open.end())
+      return;
+    backend(end_query{.handle = it->second});
+    m_pending.push_back({node, it->second});
+    m_open.erase(it);
+  }
+
+  // Gathers the results which are available, the others are tried again later
+  template <typename Backend>
+  void collect(Backend& backend)
+  {
+    std::erase_if(
+        m_pending,
+        [&](const pending& p)
+        {
+          const query_result result = backend(query_awaiter{.handle = p.query});
+          if (result.ready && !p.discard)
+            add(p.node, result.nanoseconds);
+          return result.ready;
+        });
+  }
+
+  // Also usable for CPU-side timings, e.g. of update()
+  void add(std::uint32_t node, std::uint64_t nanoseconds)
+  {
+    auto& s = m_samples[node];
+    if (s.values.size() < m_window)
+      s.values.push_back(nanoseconds);
+    else
+      s.values[s.next] = nanoseconds;
+    s.next = (s.next + 1) % m_window;
+  }
+
+  // Nodes in increasing id order
+  std::vector<summary> report() const
+  {
+    std::vector<summary> out;
+    out.reserve(m_samples.size());
+    std::vector<std::uint64_t> sorted;
+    for (const auto& [node, s] : m_samples)
+    {
+      sorted = s.values;
+      std::sort(sorted.begin(), sorted.end());
+      out.push_back(summary{
+          .node = node,
+          .samples = sorted.size(),
+          .p50_ms = percentile(sorted, 0.50) * 1e-6,
+          .p99_ms = percentile(sorted, 0.99) * 1e-6});
+    }
+    return out;
+  }
+
+  std::size_t pending_queries() const noexcept { return m_pending.size(); }
+
+private:
+  struct pending
+  {
+    std::uint32_t node;
+    query_handle query;
+    bool discard{};
+  };
+
+  struct samples
+  {
+    std::vector<std::uint64_t> values;
+    std::size_t next{};
+  };
+
+  // Nearest-rank percentile of sorted values
+  static double percentile(const std::vector<std::uint64_t>& sorted, double p) noexcept
+  {
+    if (sorted.empty())
+      return 0.;
+    const auto rank = std::size_t(std::ceil(p * sorted.size()));
+    return double(sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1]);
+  }
+
+  std::size_t m_window{};
+  std::map<std::uint32_t, query_handle> m_open;
+  std::vector<pending> m_pending;
+  std::map<std::uint32_t, samples> m_samples;
+};
+}
@@ -0,0 +1,246 @@
+#pragma once
+#include "helpers.hpp"
+#include <boost/pfr/core.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+namespace gpu
+{
+// Wait-free single-writer / single-reader triple buffer.
+// The writer fills its back buffer and publishes it ; the reader always
+// gets the most recently published one. Neither side ever waits: the two
+// only exchange buffer indices through a single atomic.
+template <typename T>
+class triple_buffer
+{
+public:
+  triple_buffer() = default;
+
+  // All three buffers start with the same value
+  explicit triple_buffer(const T& initial)
+      : m_buffers{initial, initial, initial}
+  {
+  }
+
+  // Writer side
+  T& write_buffer() noexcept { return m_buffers[m_back]; }
+
+  void publish() noexcept
+  {
+    const auto previous = m_middle.exchange(m_back | fresh, std::memory_order_acq_rel);
+    m_back = previous & index_mask;
+  }
+
+  // Reader side
+  T& read() noexcept
+  {
+    if (m_middle.load(std::memory_order_relaxed) & fresh)
+    {
+      const auto previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+      m_front = previous & index_mask;
+    }
+    return m_buffers[m_front];
+  }
+
+  // Reader side: the buffer returned by the last read()
+  T& current() noexcept { return m_buffers[m_front]; }
+  const T& current() const noexcept { return m_buffers[m_front]; }
+
+private:
+  static constexpr std::uint8_t index_mask = 0b011;
+  static constexpr std::uint8_t fresh = 0b100;
+
+  T m_buffers[3]{};
+
+  // Index of the buffer in the middle, with the fresh bit set when it
+  // has been published and not read yet
+  alignas(64) std::atomic<std::uint8_t> m_middle{1};
+  alignas(64) std::uint8_t m_back{0};
+  alignas(64) std::uint8_t m_front{2};
+};
+
+// The values of a node's uniform_control_ports bound to a given UBO or
+// push_constant block, laid out in std140 as in the block itself.
+//
+// Controls are written by the UI or audio thread, which calls publish()
+// whenever it changed some. The thread filling the UBO takes the latest
+// snapshot once per frame with acquire() - gpu::update_required() does it -
+// and reads it through inputs(), uploads() or push_constants(), without any
+// lock. Until the first publish(), the snapshot holds the default values
+// of the inputs.
+//
+//   gpu::uniform_snapshot<decltype(inputs), uniforms> controls;
+//   ...
+//   for (auto& upload : controls.uploads(ubo))
+//     co_yield upload;
+//
+// or, for a push_constant block:
+//
+//   for (auto& push : controls.push_constants())
+//     co_yield push;
+template <typename Inputs, typename Ubo>
+class uniform_snapshot
+{
+public:
+  static constexpr int size = std140_size<Ubo>();
+
+  struct block
+  {
+    // Every input, so that the reader never touches the writer's copy
+    Inputs inputs{};
+    alignas(16) char data[size];
+  };
+
+  uniform_snapshot()
+      : m_snapshots{initial_block()}
+  {
+  }
+
+  // Writer side: copies every control into the next snapshot
+  void publish(const Inputs& inputs) noexcept(std::is_nothrow_copy_assignable_v<Inputs>)
+  {
+    auto& blk = m_snapshots.write_buffer();
+    blk.inputs = inputs;
+    [&]<std::size_t... I>(std::index_sequence<I...>)
+    {
+      (write<I>(inputs, blk), ...);
+    }
+    (std::make_index_sequence<ports>{});
+    m_snapshots.publish();
+  }
+
+  // Reader side: takes the most recently published snapshot
+  void acquire() noexcept { m_snapshots.read(); }
+
+  // Reader side: the snapshot taken by the last acquire()
+  block& read() noexcept { return m_snapshots.current(); }
+  const Inputs& inputs() const noexcept { return m_snapshots.current().inputs; }
+
+  // Reader side: one upload per contiguous range of controls in the UBO,
+  // so that the other members, filled by the node, are left untouched.
+  // The data stays valid until the next acquire().
+  auto uploads(buffer_handle handle) noexcept
+  {
+    auto& blk = read();
+    std::array<dynamic_ubo_upload, ranges.size()> cmds{};
+    for (std::size_t i = 0; i < ranges.size(); i++)
+    {
+      cmds[i] = dynamic_ubo_upload{
+          .handle = handle,
+          .offset = ranges[i].offset,
+          .size = ranges[i].size,
+          .data = blk.data + ranges[i].offset};
+    }
+    return cmds;
+  }
+
+  // Reader side, for a push_constant block: the same ranges, recorded
+  // straight in the command stream.
+  auto push_constants() noexcept
+  {
+    static_assert(size <= max_push_constants_size, "push constants too large");
+    auto& blk = read();
+    std::array<set_push_constants, ranges.size()> cmds{};
+    for (std::size_t i = 0; i < ranges.size(); i++)
+    {
+      cmds[i] = set_push_constants{
+          .offset = ranges[i].offset,
+          .size = ranges[i].size,
+          .data = blk.data + ranges[i].offset};
+    }
+    return cmds;
+  }
+
+private:
+  static constexpr int ports = boost::pfr::tuple_size_v<Inputs>;
+
+  struct range
+  {
+    int offset{};
+    int size{};
+  };
+
+  // Where the I-th port goes in the block, if it is bound to this UBO
+  template <std::size_t I>
+  static consteval range control()
+  {
+    using port = boost::pfr::tuple_element_t<I, Inputs>;
+    if constexpr (requires { port::uniform(); })
+    {
+      constexpr auto member = port::uniform();
+      using ubo = typename member_pointer_class<std::remove_cv_t<decltype(member)>>::type;
+      if constexpr (std::is_same_v<ubo, Ubo>)
+      {
+        constexpr int index = field_index<member>();
+        constexpr Ubo u{};
+        return {std140_offsets<Ubo>()[index], int(sizeof((u.*member).value))};
+      }
+    }
+    return {-1, 0};
+  }
+
+  // Sorted and merged ranges of all the controls
+  static consteval auto control_ranges()
+  {
+    std::array<range, ports> all{};
+    int count = 0;
+    [&]<std::size_t... I>(std::index_sequence<I...>)
+    {
+      ((control<I>().offset >= 0 ? void(all[count++] = control<I>()) : void()), ...);
+    }
+    (std::make_index_sequence<ports>{});
+
+    std::sort(all.begin(), all.begin() + count,
+              [](range a, range b) { return a.offset < b.offset; });
+
+    int merged = 0;
+    for (int i = 0; i < count; i++)
+    {
+      if (merged > 0 && all[merged - 1].offset + all[merged - 1].size == all[i].offset)
+        all[merged - 1].size += all[i].size;
+      else
+        all[merged++] = all[i];
+    }
+    return std::pair{all, merged};
+  }
+
+  static constexpr auto ranges = []
+  {
+    constexpr auto r = control_ranges();
+    std::array<range, r.second> res{};
+    std::copy_n(r.first.begin(), r.second, res.begin());
+    return res;
+  }();
+
+  static block initial_block() noexcept
+  {
+    block blk{};
+    [&]<std::size_t... I>(std::index_sequence<I...>)
+    {
+      (write<I>(blk.inputs, blk), ...);
+    }
+    (std::make_index_sequence<ports>{});
+    return blk;
+  }
+
+  template <std::size_t I>
+  static void write(const Inputs& inputs, block& blk) noexcept
+  {
+    constexpr auto c = control<I>();
+    if constexpr (c.offset >= 0)
+    {
+      const auto& value = boost::pfr::get<I>(inputs).value;
+      static_assert(sizeof(value) == c.size, "control and uniform types differ in size");
+      std::memcpy(blk.data + c.offset, &value, c.size);
+    }
+  }
+
+  triple_buffer<block> m_snapshots;
+};
+}
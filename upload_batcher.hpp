@@ -0,0 +1,315 @@
+#pragma once
+#include "helpers.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace gpu
+{
+// Sits in front of a backend and turns all the uploads of a frame, from
+// every node, into a single host to device transfer.
+//
+// Buffer uploads, and texture uploads replacing a whole single-level
+// texture, are held back. On flush() they are sorted by destination, adjacent
+// or overlapping ranges are merged (later writes win), and everything is
+// packed in one staging buffer: one static_upload, then one device-side copy
+// per merged range.
+// Any command which could observe the uploaded data flushes first ;
+// allocations and getters go straight through.
+//
+// Payloads in the backend's staging arena (gpu::allocate_staging) stay valid
+// until its end_frame() and are read in place ; the others are copied.
+// Every flush of a frame gets its own staging buffer, and a frame's buffers
+// are only reused "frames_in_flight" frames later, once the GPU is done
+// copying from them.
+template <typename Backend>
+class upload_batcher
+{
+public:
+  struct statistics
+  {
+    // Before coalescing
+    std::size_t uploads{};
+    std::size_t upload_bytes{};
+
+    // After coalescing
+    std::size_t transfers{};
+    std::size_t transfer_bytes{};
+    std::size_t copies{};
+  };
+
+  explicit upload_batcher(Backend& backend, int frames_in_flight = 2)
+      : m_backend{backend}
+      , m_staging(std::max(frames_in_flight, 1))
+  {
+  }
+
+  upload_batcher(const upload_batcher&) = delete;
+  upload_batcher& operator=(const upload_batcher&) = delete;
+
+  ~upload_batcher()
+  {
+    for (const auto& frame : m_staging)
+      for (const auto& buf : frame)
+        m_backend(buffer_release{.handle = buf.handle});
+  }
+
+  template <typename C>
+  typename C::return_type operator()(const C& command)
+  {
+    if constexpr (requires { C::upload; C::texture; })
+    {
+      if (batchable(command))
+        record(command.handle, command.offset, command.size, command.data);
+      else
+        forward(command);
+    }
+    else if constexpr (requires { C::upload; })
+    {
+      record(command.handle, command.offset, command.size, command.data);
+    }
+    else if constexpr (requires { C::allocation; C::texture; })
+    {
+      auto handle = m_backend(command);
+      if (command.mip_levels == 1 && command.array_layers <= 1)
+        m_texture_sizes[handle] = texture_bytes(command.format, command.width, command.height);
+      return handle;
+    }
+    else if constexpr (requires { C::allocation; } || requires { C::getter; })
+    {
+      return m_backend(command);
+    }
+    else
+    {
+      if constexpr (requires { C::deallocation; })
+      {
+        if constexpr (std::is_same_v<decltype(command.handle), texture_handle>)
+          m_texture_sizes.erase(command.handle);
+      }
+      return forward(command);
+    }
+  }
+
+  // Submits everything held back: to be called before the frame is submitted
+  void flush()
+  {
+    if (m_pending.empty())
+      return;
+
+    pack();
+    upload();
+
+    m_pending.clear();
+    m_payloads.clear();
+  }
+
+  void end_frame()
+  {
+    flush();
+    m_frame = (m_frame + 1) % m_staging.size();
+    m_flushes = 0;
+    if constexpr (requires { m_backend.end_frame(); })
+      m_backend.end_frame();
+  }
+
+  // Forwarded so that the batcher can sit in front of any other layer
+  bool owns_staging(const void* ptr) const
+  {
+    if constexpr (requires { m_backend.owns_staging(ptr); })
+      return m_backend.owns_staging(ptr);
+    else
+      return false;
+  }
+
+  const statistics& stats() const noexcept { return m_stats; }
+
+private:
+  struct pending_upload
+  {
+    const void* destination{};
+    bool texture{};
+    int offset{};
+    int size{};
+    // Either in the staging arena, or at this offset in m_payloads
+    const char* source{};
+    std::size_t payload{};
+    int sequence{};
+  };
+
+  // A merged range and where it is in the packed staging buffer
+  struct transfer
+  {
+    const void* destination{};
+    bool texture{};
+    int offset{};
+    int size{};
+    int staging_offset{};
+  };
+
+  struct staging_buffer
+  {
+    buffer_handle handle{};
+    int size{};
+  };
+
+  template <typename C>
+  typename C::return_type forward(const C& command)
+  {
+    flush();
+    return m_backend(command);
+  }
+
+  bool batchable(const texture_upload& command) const
+  {
+    if (command.width > 0 || command.height > 0 || command.data_format || command.premultiply)
+      return false;
+    auto it = m_texture_sizes.find(command.handle);
+    return it != m_texture_sizes.end() && command.offset == 0 && command.size == it->second;
+  }
+
+  template <typename Handle>
+  void record(Handle handle, int offset, int size, const void* data)
+  {
+    // The node may reuse its own memory as soon as the command returns,
+    // but not the staging memory it got from the backend
+    const char* source{};
+    const auto payload = m_payloads.size();
+    if (owns_staging(data))
+      source = static_cast<const char*>(data);
+    else
+      m_payloads.insert(
+          m_payloads.end(), static_cast<const char*>(data), static_cast<const char*>(data) + size);
+
+    m_pending.push_back(pending_upload{
+        .destination = handle,
+        .texture = std::is_same_v<Handle, texture_handle>,
+        .offset = offset,
+        .size = size,
+        .source = source,
+        .payload = payload,
+        .sequence = int(m_pending.size())});
+
+    m_stats.uploads++;
+    m_stats.upload_bytes += size;
+  }
+
+  // Sorts by destination, merges what touches, and lays it out in m_packed
+  void pack()
+  {
+    std::sort(
+        m_pending.begin(), m_pending.end(),
+        [](const pending_upload& a, const pending_upload& b)
+        {
+          if (a.destination != b.destination)
+            return std::less<>{}(a.destination, b.destination);
+          if (a.offset != b.offset)
+            return a.offset < b.offset;
+          return a.sequence < b.sequence;
+        });
+
+    m_transfers.clear();
+    m_packed.clear();
+    for (std::size_t first = 0; first < m_pending.size();)
+    {
+      const auto head = m_pending[first];
+      int end = head.offset + head.size;
+      std::size_t last = first + 1;
+      while (last < m_pending.size() && m_pending[last].destination == head.destination
+             && m_pending[last].offset <= end)
+      {
+        end = std::max(end, m_pending[last].offset + m_pending[last].size);
+        last++;
+      }
+
+      // Copies from the staging buffer must be aligned on the device
+      const int staging_offset = (int(m_packed.size()) + 15) & ~15;
+      m_packed.resize(staging_offset + (end - head.offset));
+      m_transfers.push_back(transfer{
+          .destination = head.destination,
+          .texture = head.texture,
+          .offset = head.offset,
+          .size = end - head.offset,
+          .staging_offset = staging_offset});
+
+      // Overlapping writes are applied in the order they were made
+      std::sort(
+          m_pending.begin() + first, m_pending.begin() + last,
+          [](const pending_upload& a, const pending_upload& b)
+          { return a.sequence < b.sequence; });
+      for (std::size_t i = first; i < last; i++)
+      {
+        const auto& up = m_pending[i];
+        std::memcpy(
+            m_packed.data() + staging_offset + (up.offset - head.offset),
+            up.source ? up.source : m_payloads.data() + up.payload, up.size);
+      }
+
+      first = last;
+    }
+  }
+
+  void upload()
+  {
+    const int size = m_packed.size();
+    auto& frame = m_staging[m_frame];
+    if (m_flushes == frame.size())
+      frame.emplace_back();
+    auto& staging = frame[m_flushes++];
+    if (size > staging.size)
+    {
+      if (staging.handle)
+        m_backend(buffer_release{.handle = staging.handle});
+      staging.handle = m_backend(static_allocation{.binding = -1, .size = size});
+      staging.size = size;
+    }
+
+    m_backend(static_upload{
+        .handle = staging.handle, .offset = 0, .size = size, .data = m_packed.data()});
+    m_stats.transfers++;
+    m_stats.transfer_bytes += size;
+
+    for (const auto& t : m_transfers)
+    {
+      if (t.texture)
+      {
+        m_backend(copy_buffer_to_texture{
+            .src = staging.handle,
+            .src_offset = t.staging_offset,
+            .dst = (texture_handle)t.destination,
+            .size = t.size});
+      }
+      else
+      {
+        m_backend(copy_buffer{
+            .src = staging.handle,
+            .src_offset = t.staging_offset,
+            .dst = (buffer_handle)t.destination,
+            .dst_offset = t.offset,
+            .size = t.size});
+      }
+      m_stats.copies++;
+    }
+  }
+
+  Backend& m_backend;
+
+  std::vector<pending_upload> m_pending;
+  std::vector<char> m_payloads;
+  std::vector<transfer> m_transfers;
+  std::vector<char> m_packed;
+
+  // Per frame in flight, one staging buffer per flush of that frame
+  std::vector<std::vector<staging_buffer>> m_staging;
+  std::size_t m_frame{};
+  std::size_t m_flushes{};
+
+  // Whole-texture sizes of the textures which can go through the staging buffer
+  std::unordered_map<texture_handle, int> m_texture_sizes;
+
+  statistics m_stats;
+};
+}
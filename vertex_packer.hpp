@@ -0,0 +1,148 @@
+#pragma once
+#include "helpers.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace gpu
+{
+// Packs separate per-attribute arrays into a vertex buffer laid out as
+// declared by a layout's vertex_input struct, e.g.
+//
+//   using packer = gpu::vertex_packer<decltype(layout::vertex_input)>;
+//   auto mem = co_yield gpu::allocate_staging{.size = packer::interleaved_size(n)};
+//   packer::interleave(mem.data, n, {positions, texcoords});
+//   co_yield gpu::dynamic_vertex_upload{..., .size = mem.size, .data = mem.data};
+//
+// Attributes are tightly packed in declaration order. Each source array
+// holds "count" elements of the attribute's data type.
+template <typename VertexInput>
+class vertex_packer
+{
+public:
+  static constexpr int attributes = reflect::field_count<VertexInput>;
+  static_assert(attributes > 0, "no vertex attributes");
+
+  // Bytes of each attribute
+  static constexpr std::array<int, attributes> sizes = []
+  {
+    std::array<int, attributes> s{};
+    [&]<std::size_t... I>(std::index_sequence<I...>)
+    {
+      ((s[I] = sizeof(reflect::member_t<I, VertexInput>::data)), ...);
+    }
+    (std::make_index_sequence<attributes>{});
+    return s;
+  }();
+
+  // Offset of each attribute in an interleaved vertex
+  static constexpr std::array<int, attributes> offsets = []
+  {
+    std::array<int, attributes> o{};
+    int offset = 0;
+    for (int i = 0; i < attributes; i++)
+    {
+      o[i] = offset;
+      offset += sizes[i];
+    }
+    return o;
+  }();
+
+  static constexpr int stride = []
+  {
+    int s = 0;
+    for (int sz : sizes)
+      s += sz;
+    return s;
+  }();
+
+  using sources = std::array<const void*, attributes>;
+
+  static constexpr std::size_t interleaved_size(std::size_t count) noexcept
+  {
+    return count * stride;
+  }
+
+  static constexpr std::size_t soa_size(std::size_t count) noexcept
+  {
+    return count * stride;
+  }
+
+  // Where an attribute's array starts in a SoA buffer of "count" vertices
+  static constexpr std::size_t soa_offset(int attribute, std::size_t count) noexcept
+  {
+    return count * offsets[attribute];
+  }
+
+  // position0 texcoord0 position1 texcoord1 ...
+  static void interleave(void* dst, std::size_t count, const sources& src) noexcept
+  {
+    auto out = static_cast<char*>(dst);
+    std::size_t v = 0;
+
+#if defined(__SSE2__)
+    // Every attribute is copied with 16-byte moves, which may spill over the
+    // following ones: they are written right after and fix it. Each source is
+    // read up to 15 bytes past the current element, hence the scalar tail.
+    constexpr std::size_t tail = (15 + min_size() - 1) / min_size();
+    if (count > tail)
+    {
+      for (; v < count - tail; v++)
+      {
+        char* vertex = out + v * stride;
+        [&]<std::size_t... I>(std::index_sequence<I...>)
+        {
+          (copy_wide<sizes[I]>(vertex + offsets[I], static_cast<const char*>(src[I]) + v * sizes[I]), ...);
+        }
+        (std::make_index_sequence<attributes>{});
+      }
+    }
+#endif
+
+    for (; v < count; v++)
+    {
+      char* vertex = out + v * stride;
+      [&]<std::size_t... I>(std::index_sequence<I...>)
+      {
+        (std::memcpy(vertex + offsets[I], static_cast<const char*>(src[I]) + v * sizes[I], sizes[I]), ...);
+      }
+      (std::make_index_sequence<attributes>{});
+    }
+  }
+
+  // All the positions, then all the texcoords, ...
+  static void soa(void* dst, std::size_t count, const sources& src) noexcept
+  {
+    if (count == 0)
+      return;
+
+    auto out = static_cast<char*>(dst);
+    for (int i = 0; i < attributes; i++)
+      std::memcpy(out + soa_offset(i, count), src[i], count * sizes[i]);
+  }
+
+private:
+  static constexpr std::size_t min_size()
+  {
+    int m = sizes[0];
+    for (int sz : sizes)
+      m = sz < m ? sz : m;
+    return m;
+  }
+
+#if defined(__SSE2__)
+  template <int Size>
+  static void copy_wide(char* dst, const char* src) noexcept
+  {
+    for (int i = 0; i < Size; i += 16)
+      _mm_storeu_si128((__m128i*)(dst + i), _mm_loadu_si128((const __m128i*)(src + i)));
+  }
+#endif
+};
+}